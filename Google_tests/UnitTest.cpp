@@ -1,9 +1,15 @@
 #include "gtest/gtest.h"
 #include "RangeQuery.h"
+#include "BoxJoin.h"
+#include "VersionedRangeQuery.h"
+#include "PointFile.h"
+#include "Trace.h"
 #include <algorithm>
 #include <vector>
 #include <sstream>
 #include <random>
+#include <cstdio>
+#include <thread>
 
 using namespace std;
 
@@ -12,9 +18,10 @@ namespace UnitTest {
     /// Tests two point vectors of equality.
     /// </summary>
     /// <typeparam name="P">point data type</typeparam>
+    /// <typeparam name="E">key encoding</typeparam>
     /// <param name="p">pair of point vectors</param>
-    template<typename P>
-    static void test(const RangeQuery<P> &rq, const P &from, const P &to) {
+    template<typename P, typename E>
+    static void test(const RangeQuery<P, E> &rq, const P &from, const P &to) {
         auto v1 = rq.trivial(from, to);
         sort(v1.begin(), v1.end());
 
@@ -83,6 +90,20 @@ namespace UnitTest {
         }
     }
 
+    TEST(RangeQuery, ExtremeBounds1D) {
+        constexpr int lo = numeric_limits<int>::lowest();
+        constexpr int hi = numeric_limits<int>::max();
+        vector<Point1> v({hi, 4, lo, 2, hi, 5, lo, 9});
+        RangeQuery<Point1> rq(v, 1);
+
+        test(rq, {lo}, {hi});
+        test(rq, {5}, {hi});
+        test(rq, {hi}, {hi});
+        test(rq, {lo}, {lo});
+        test(rq, {lo}, {4});
+        ASSERT_EQ(v.size(), rq.efficient({lo}, {hi}).size());
+    }
+
     TEST(RangeQuery, Simple2D) {
         vector<Point2> v({{4, 6},
                           {1, 5},
@@ -197,6 +218,111 @@ namespace UnitTest {
         }
     }
 
+    TEST(RangeQuery, ThreeSided2D) {
+        constexpr int lo = numeric_limits<int>::lowest();
+        constexpr int hi = numeric_limits<int>::max();
+        vector<Point2> v({{4, 6},
+                          {1, 5},
+                          {2, 7},
+                          {3, 8},
+                          {1, 1},
+                          {2, 5},
+                          {6, 1},
+                          {4, 4},
+                          {2, 7},
+                          {4, 4}});
+        RangeQuery<Point2> rq(v);
+
+        test(rq, {1, 5}, {3, hi});
+        test(rq, {1, lo}, {3, 5});
+        test(rq, {2, 4}, {hi, 7});
+        test(rq, {lo, 4}, {2, 7});
+        test(rq, {lo, lo}, {hi, hi});
+        test(rq, {5, 9}, {7, hi});
+        test(rq, {4, 4}, {4, hi});
+    }
+
+    TEST(RangeQuery, RandomThreeSided2D) {
+        constexpr int lo = numeric_limits<int>::lowest();
+        constexpr int hi = numeric_limits<int>::max();
+        uniform_int_distribution<Point2::ElementType> coordsRange(-100, +100);
+
+        // create point vector of random length
+        uniform_int_distribution<size_t> numPoints(500, 1000);
+        const size_t n = numPoints(engine);
+        vector<Point2> v(n);
+
+        // fill in point vector with random points
+        for (size_t i = 0; i < n; i++) {
+            v[i] = Point2({coordsRange(engine), coordsRange(engine)});
+        }
+
+        // run k random queries, each with one unbounded side
+        RangeQuery<Point2> rq(v);
+        const size_t k = v.size() / 2;
+
+        for (size_t i = 0; i < k; i++) {
+            auto p1x = coordsRange(engine);
+            auto p2x = coordsRange(engine);
+            auto p1y = coordsRange(engine);
+            auto p2y = coordsRange(engine);
+            if (p2x < p1x) swap(p1x, p2x);
+            if (p2y < p1y) swap(p1y, p2y);
+            switch (i % 4) {
+                case 0: p2y = hi; break;
+                case 1: p1y = lo; break;
+                case 2: p2x = hi; break;
+                default: p1x = lo; break;
+            }
+            test(rq, Point2({p1x, p1y}), Point2({p2x, p2y}));
+        }
+    }
+
+    TEST(RangeQuery, ParallelReport2D) {
+        uniform_int_distribution<Point2::ElementType> coordsRange(-1000, +1000);
+
+        // enough points that large results are copied by several threads
+        const size_t n = 4 * MinPointsPerThread;
+        vector<Point2> v(n);
+
+        for (size_t i = 0; i < n; i++) {
+            v[i] = Point2({coordsRange(engine), coordsRange(engine)});
+        }
+
+        RangeQuery<Point2> rq(v);
+
+        for (unsigned threads: {1, 3, 4}) {
+            for (size_t i = 0; i < 5; i++) {
+                auto p1x = coordsRange(engine) / 4 - 750;
+                auto p1y = coordsRange(engine) / 4 - 750;
+                auto p2x = coordsRange(engine) / 4 + 750;
+                auto p2y = coordsRange(engine) / 4 + 750;
+
+                auto v1 = rq.trivial(Point2({p1x, p1y}), Point2({p2x, p2y}));
+                auto v2 = rq.efficient(Point2({p1x, p1y}), Point2({p2x, p2y}), threads);
+                sort(v2.begin(), v2.end());
+
+                ASSERT_EQ(v1, v2);
+            }
+
+            // boxes with an unbounded side are answered by the priority search trees
+            for (size_t i = 0; i < 4; i++) {
+                Point2 from({coordsRange(engine) / 4 - 750, coordsRange(engine) / 4 - 750});
+                Point2 to({coordsRange(engine) / 4 + 750, coordsRange(engine) / 4 + 750});
+
+                if (i < 2) {
+                    (i == 0 ? to : from)[1] = i == 0 ? numeric_limits<int>::max() : numeric_limits<int>::lowest();
+                } else {
+                    (i == 2 ? to : from)[0] = i == 2 ? numeric_limits<int>::max() : numeric_limits<int>::lowest();
+                }
+
+                auto v2 = rq.efficient(from, to, threads);
+                sort(v2.begin(), v2.end());
+                ASSERT_EQ(rq.trivial(from, to), v2);
+            }
+        }
+    }
+
     TEST(RangeQuery, Simple3D) {
         vector<Point3> v({{4,   6,   4.5},
                           {1,   5,   4},
@@ -268,7 +394,7 @@ namespace UnitTest {
 
         // fill in point vector with random points
         for (size_t i = 0; i < n; i++) {
-            v[i] = Point3({coordsRange(engine), coordsRange(engine)});
+            v[i] = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
         }
 
         // run k random queries
@@ -288,4 +414,652 @@ namespace UnitTest {
             test(rq, Point3({p1x, p1y, p1z}), Point3({p2x, p2y, p2z}));
         }
     }
+
+    TEST(RangeQuery, LeafSizes3D) {
+        vector<Point3> v({{4,   6,   4.5},
+                          {1,   5,   4},
+                          {2.5, 7,   6},
+                          {3,   8,   3},
+                          {1,   1.5, 5},
+                          {2.5, 5.5, 1},
+                          {6,   1,   2},
+                          {4,   4,   7},
+                          {4,   6,   4.5},
+                          {1,   5,   4},
+                          {2.5, 7,   6}});
+
+        for (size_t leafSize: {0, 1, 2, 3, 5, 11, 12}) {
+            RangeQuery<Point3> rq(v, leafSize);
+
+            test(rq, {1, 1, 1.5}, {7, 7, 3});
+            test(rq, {1, 1, 4}, {2, 7, 6});
+            test(rq, {1, 1, 1}, {3, 7, 7});
+            test(rq, {2, 6, 2}, {3, 7, 4});
+            test(rq, {3, 6, 2}, {3, 7, 2});
+            test(rq, {4, 5.5, 0}, {4, 7, 8});
+            test(rq, {5, 6, 1}, {5, 8, 3});
+        }
+    }
+
+    TEST(RangeQuery, RandomLeafSizes3D) {
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+
+        // create point vector of random length
+        uniform_int_distribution<size_t> numPoints(333, 666);
+        const size_t n = numPoints(engine);
+        vector<Point3> v(n);
+
+        // fill in point vector with random points
+        for (size_t i = 0; i < n; i++) {
+            v[i] = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+        }
+
+        // run k random queries for each leaf size
+        for (size_t leafSize: {1, 2, 7, 16, 64}) {
+            RangeQuery<Point3> rq(v, leafSize);
+            const size_t k = v.size() / 4;
+
+            for (size_t i = 0; i < k; i++) {
+                auto p1x = coordsRange(engine);
+                auto p2x = coordsRange(engine);
+                auto p1y = coordsRange(engine);
+                auto p2y = coordsRange(engine);
+                auto p1z = coordsRange(engine);
+                auto p2z = coordsRange(engine);
+                if (p2x < p1x) swap(p1x, p2x);
+                if (p2y < p1y) swap(p1y, p2y);
+                if (p2z < p1z) swap(p1z, p2z);
+                test(rq, Point3({p1x, p1y, p1z}), Point3({p2x, p2y, p2z}));
+            }
+        }
+    }
+
+    TEST(RangeQuery, WideBoxes3D) {
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+        normal_distribution<Point3::ElementType> noise(0, 5);
+
+        // correlated points along the diagonal, so that many canonical subtrees are inside or outside the boxes
+        vector<Point3> v(500);
+        for (auto &p: v) {
+            const double t = coordsRange(engine);
+            p = Point3({t, t + noise(engine), t + noise(engine)});
+        }
+
+        for (size_t leafSize: {1, 4}) {
+            RangeQuery<Point3> rq(v, leafSize);
+
+            for (size_t i = 0; i < 100; i++) {
+                const double x = coordsRange(engine);
+                test(rq, Point3({x, x - 50, x - 50}), Point3({x + 60, x + 80, x + 80}));
+                test(rq, Point3({x, -200, -200}), Point3({x + 60, 200, 200}));
+                test(rq, Point3({x, x + 20, -200}), Point3({x + 60, 200, x + 70}));
+            }
+        }
+    }
+
+    TEST(RangeQuery, KeyEncodings3D) {
+        // coordinates differing in the last bits of a double collide in the reduced precision keys
+        const double e = 1e-12;
+        vector<Point3> v({{1,     1,     1},
+                          {1 + e, 1,     1},
+                          {1,     1 + e, 1 + e},
+                          {1.001, 1.002, 1.003},
+                          {1.002, 1.001, 1},
+                          {-1,    -1,    -1 - e},
+                          {0,     -0.0,  0}});
+        RangeQuery<Point3, FloatKey<double>> rqFloat(v, 1);
+        RangeQuery<Point3, BFloat16Key<double>> rqBFloat(v, 1);
+
+        for (const auto &[from, to]: vector<pair<Point3, Point3>>({{{1, 1, 1},         {1, 1, 1}},
+                                                                  {{1 + e, 1, 1},     {2, 2, 2}},
+                                                                  {{1, 1, 1},         {1.001, 1.001, 1.001}},
+                                                                  {{-1, -1, -1},      {1, 1, 1}},
+                                                                  {{-0.0, 0, -0.0},   {0, 0, 0}},
+                                                                  {{-2, -2, -2},      {2, 2, 2}}})) {
+            test(rqFloat, from, to);
+            test(rqBFloat, from, to);
+        }
+    }
+
+    TEST(RangeQuery, RandomKeyEncodings3D) {
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+
+        // create point vector of random length
+        uniform_int_distribution<size_t> numPoints(333, 666);
+        const size_t n = numPoints(engine);
+        vector<Point3> v(n);
+
+        // fill in point vector with random points
+        for (size_t i = 0; i < n; i++) {
+            v[i] = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+        }
+
+        // run k random queries
+        RangeQuery<Point3, FloatKey<double>> rqFloat(v, 4);
+        RangeQuery<Point3, BFloat16Key<double>> rqBFloat(v, 4);
+        const size_t k = v.size() / 2;
+
+        for (size_t i = 0; i < k; i++) {
+            auto p1x = coordsRange(engine);
+            auto p2x = coordsRange(engine);
+            auto p1y = coordsRange(engine);
+            auto p2y = coordsRange(engine);
+            auto p1z = coordsRange(engine);
+            auto p2z = coordsRange(engine);
+            if (p2x < p1x) swap(p1x, p2x);
+            if (p2y < p1y) swap(p1y, p2y);
+            if (p2z < p1z) swap(p1z, p2z);
+            test(rqFloat, Point3({p1x, p1y, p1z}), Point3({p2x, p2y, p2z}));
+            test(rqBFloat, Point3({p1x, p1y, p1z}), Point3({p2x, p2y, p2z}));
+        }
+    }
+
+    TEST(RangeQuery, ExtremeBounds3D) {
+        const double max = numeric_limits<double>::max();
+        const double inf = numeric_limits<double>::infinity();
+        vector<Point3> v({{max,  1,    -max},
+                          {1,    max,  max},
+                          {-max, -max, 1},
+                          {max,  max,  max},
+                          {1,    2,    3},
+                          {-1,   -2,   -3}});
+        RangeQuery<Point3> rqExact(v, 1);
+        RangeQuery<Point3, FloatKey<double>> rqFloat(v, 1);
+        RangeQuery<Point3, BFloat16Key<double>> rqBFloat(v, 1);
+
+        for (const auto &[from, to]: vector<pair<Point3, Point3>>({{{-max, -max, -max}, {max, max, max}},
+                                                                  {{-inf, -inf, -inf}, {inf, inf, inf}},
+                                                                  {{1, 1, 1},          {max, max, max}},
+                                                                  {{max, -max, -max},  {max, max, max}},
+                                                                  {{-inf, -max, 0},    {1, max, inf}}})) {
+            test(rqExact, from, to);
+            test(rqFloat, from, to);
+            test(rqBFloat, from, to);
+        }
+        ASSERT_EQ(v.size(), rqExact.efficient({-max, -max, -max}, {max, max, max}).size());
+    }
+
+    template<typename E, typename T>
+    static void testKeyBounds(const T &value) {
+        const auto key = E::encode(value);
+
+        ASSERT_LE(E::lower(key), value);
+        ASSERT_GE(E::upper(key), value);
+    }
+
+    TEST(RangeQuery, Empty2D) {
+        constexpr int hi = numeric_limits<int>::max();
+        const string fileName = "Empty2D.rqp";
+
+        // an empty point file gives an index without points, which answers all queries empty
+        writePointFile(fileName, vector<Point2>());
+        RangeQuery<Point2> rq(readPointFile<Point2>(fileName), 4);
+        mt19937_64 rng(5);
+
+        ASSERT_TRUE(rq.points().empty());
+        ASSERT_TRUE(rq.efficient(Point2({-10, -10}), Point2({10, 10})).empty());
+        ASSERT_TRUE(rq.efficient(Point2({-10, -10}), Point2({10, hi})).empty());
+        ASSERT_TRUE(rq.sample(Point2({-10, -10}), Point2({10, 10}), 3, rng).empty());
+        ASSERT_EQ(size_t(0), rq.efficientBitmap(Point2({-10, -10}), Point2({10, 10})).size());
+        ASSERT_TRUE(rq.efficientRadius(Point2({0, 0}), 10).empty());
+        remove(fileName.c_str());
+
+        RangeQuery<Point3> rq3(vector<Point3>{}, 1, AssocMode::Lazy);
+        ASSERT_TRUE(rq3.efficient(Point3({-10, -10, -10}), Point3({10, 10, 10})).empty());
+        ASSERT_TRUE(rq3.efficientRadius(Point3({0, 0, 0}), 10).empty());
+    }
+
+    TEST(KeyEncoding, Bounds) {
+        uniform_real_distribution<double> mantissaRange(-1, +1);
+        uniform_int_distribution<int> exponentRange(-140, +140);
+        uniform_int_distribution<int> intRange(numeric_limits<int>::lowest(), numeric_limits<int>::max());
+        const double max = numeric_limits<double>::max();
+        const double inf = numeric_limits<double>::infinity();
+
+        for (double value: {-inf, -max, -1e300, -1.0, -0.0, 0.0, 1e-300, 1.0, 1e300, max, inf}) {
+            testKeyBounds<FloatKey<double>>(value);
+            testKeyBounds<BFloat16Key<double>>(value);
+        }
+        for (int n = 0; n < 10000; n++) {
+            const double value = ldexp(mantissaRange(engine), exponentRange(engine));
+            const int i = intRange(engine);
+
+            testKeyBounds<FloatKey<double>>(value);
+            testKeyBounds<BFloat16Key<double>>(value);
+            testKeyBounds<FloatKey<int>>(i);
+            testKeyBounds<BFloat16Key<int>>(i);
+        }
+    }
+
+    TEST(RangeQuery, LazyAssoc3D) {
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+
+        vector<Point3> v(3000);
+        for (auto &p: v) p = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+
+        vector<pair<Point3, Point3>> boxes(400);
+        for (auto &[from, to]: boxes) {
+            for (dim_t i = 0; i < 3; i++) {
+                from[i] = coordsRange(engine);
+                to[i] = coordsRange(engine);
+                if (to[i] < from[i]) swap(from[i], to[i]);
+            }
+        }
+
+        // queries of several threads reach the same nodes first
+        RangeQuery<Point3> rq(v, 4, AssocMode::Lazy);
+        vector<vector<Point3>> results(boxes.size());
+        vector<thread> workers;
+
+        for (size_t t = 0; t < 4; t++) {
+            workers.emplace_back([&, t]() {
+                for (size_t i = t; i < boxes.size(); i += 4) results[i] = rq.efficient(boxes[i].first, boxes[i].second, 1);
+            });
+        }
+        for (auto &worker: workers) worker.join();
+
+        for (size_t i = 0; i < boxes.size(); i++) {
+            sort(results[i].begin(), results[i].end());
+            ASSERT_EQ(rq.trivial(boxes[i].first, boxes[i].second), results[i]);
+        }
+        for (const auto &[from, to]: boxes) test(rq, from, to);
+    }
+
+    TEST(RangeQuery, RandomBitmap3D) {
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+
+        vector<Point3> v(3000);
+        for (auto &p: v) p = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+
+        // the indices refer to the points sorted by x: they are contiguous in the canonical subtrees of the x-tree,
+        // but not in the associated trees
+        for (size_t leafSize: {1, 4}) {
+            RangeQuery<Point3> rq(v, leafSize);
+            Bitmap previous(v.size());
+
+            for (size_t i = 0; i < 100; i++) {
+                Point3 from, to;
+
+                for (dim_t j = 0; j < 3; j++) {
+                    from[j] = coordsRange(engine);
+                    to[j] = coordsRange(engine);
+                    if (to[j] < from[j]) swap(from[j], to[j]);
+                }
+
+                const Bitmap bitmap = rq.efficientBitmap(from, to);
+                vector<Point3> result;
+
+                bitmap.forEach([&](size_t id) { result.push_back(rq.points()[id]); });
+                sort(result.begin(), result.end());
+                ASSERT_EQ(rq.trivial(from, to), result);
+                ASSERT_EQ(result.size(), bitmap.count());
+
+                // combined bitmaps
+                const Bitmap both = bitmap & previous, either = bitmap | previous;
+
+                for (size_t id = 0; id < v.size(); id++) {
+                    ASSERT_EQ(bitmap.test(id) && previous.test(id), both.test(id));
+                    ASSERT_EQ(bitmap.test(id) || previous.test(id), either.test(id));
+                }
+                previous = bitmap;
+            }
+        }
+    }
+
+    TEST(RangeQuery, UnboundedBitmapSample2D) {
+        constexpr int lo = numeric_limits<int>::lowest();
+        constexpr int hi = numeric_limits<int>::max();
+        uniform_int_distribution<Point2::ElementType> coordsRange(-1000, +1000);
+
+        vector<Point2> v(1000);
+        for (auto &p: v) p = Point2({coordsRange(engine), coordsRange(engine)});
+        v[0] = Point2({lo, hi});
+        v[1] = Point2({hi, lo});
+
+        // efficient() answers these boxes with the priority search trees, bitmaps and samples always come from the
+        // range tree
+        RangeQuery<Point2> rq(v, 4);
+        mt19937_64 rng(3);
+
+        for (const auto &[from, to]: vector<pair<Point2, Point2>>({{{0, 500},  {10, hi}},
+                                                                  {{lo, lo},  {hi, hi}},
+                                                                  {{lo, -20}, {300, 40}},
+                                                                  {{-50, lo}, {50, 0}},
+                                                                  {{hi, lo},  {hi, hi}},
+                                                                  {{lo, hi},  {hi, hi}}})) {
+            const Bitmap bitmap = rq.efficientBitmap(from, to);
+            vector<Point2> result;
+
+            bitmap.forEach([&](size_t id) { result.push_back(rq.points()[id]); });
+            sort(result.begin(), result.end());
+            ASSERT_EQ(rq.trivial(from, to), result);
+
+            result = rq.sample(from, to, v.size(), rng);
+            sort(result.begin(), result.end());
+            ASSERT_EQ(rq.trivial(from, to), result);
+        }
+    }
+
+    TEST(RangeQuery, SampleKeyEncodings3D) {
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+        const double inf = numeric_limits<double>::infinity();
+
+        vector<Point3> v(3000);
+        for (auto &p: v) p = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+
+        RangeQuery<Point3, FloatKey<double>> rqFloat(v, 4);
+        RangeQuery<Point3, BFloat16Key<double>> rqBFloat(v, 4);
+        mt19937_64 rng(5);
+
+        for (size_t i = 0; i < 100; i++) {
+            Point3 from({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+            Point3 to({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+            for (dim_t j = 0; j < 3; j++) if (from[j] > to[j]) swap(from[j], to[j]);
+            if (i % 10 == 0) to[i % 3] = inf;
+            const auto all = rqBFloat.trivial(from, to);
+
+            for (size_t k: {size_t(10), v.size()}) {
+                auto s1 = rqFloat.sample(from, to, k, rng);
+                auto s2 = rqBFloat.sample(from, to, k, rng);
+
+                ASSERT_EQ(min(k, all.size()), s1.size());
+                ASSERT_EQ(min(k, all.size()), s2.size());
+                sort(s1.begin(), s1.end());
+                sort(s2.begin(), s2.end());
+                ASSERT_TRUE(includes(all.begin(), all.end(), s1.begin(), s1.end()));
+                ASSERT_TRUE(includes(all.begin(), all.end(), s2.begin(), s2.end()));
+            }
+        }
+    }
+
+    TEST(Bitmap, SetRange) {
+        for (size_t beg: {0, 1, 63, 64, 65, 130}) {
+            for (size_t end: {0, 1, 63, 64, 65, 127, 128, 200}) {
+                Bitmap bitmap(200);
+
+                bitmap.setRange(beg, end);
+                for (size_t i = 0; i < bitmap.size(); i++) ASSERT_EQ(beg <= i && i < end, bitmap.test(i));
+                ASSERT_EQ(beg < end ? end - beg : 0, bitmap.count());
+            }
+        }
+    }
+
+    TEST(Box, Predicates2D) {
+        uniform_int_distribution<Point2::ElementType> coordsRange(-20, +20);
+
+        for (int n = 0; n < 2000; n++) {
+            Point2 p({coordsRange(engine), coordsRange(engine)});
+            Point2 q({coordsRange(engine), coordsRange(engine)});
+            Point2 r({coordsRange(engine), coordsRange(engine)});
+            Point2 s({coordsRange(engine), coordsRange(engine)});
+            const Box<Point2::ElementType, 2> a(p, q), b(r, s);
+
+            bool contains = true, intersects = true, containsBox = true, containsInterior = true;
+            for (dim_t i = 0; i < 2; i++) {
+                contains = contains && p[i] <= r[i] && r[i] <= q[i];
+                intersects = intersects && p[i] <= s[i] && r[i] <= q[i];
+                containsBox = containsBox && p[i] <= r[i] && s[i] <= q[i];
+                containsInterior = containsInterior && p[i] < r[i] && s[i] < q[i];
+            }
+            ASSERT_EQ(contains, a.contains(r));
+            ASSERT_EQ(contains, r >= p && r <= q);
+            ASSERT_EQ(intersects, a.intersects(b));
+            ASSERT_EQ(containsBox, a.containsBox(b));
+            ASSERT_EQ(containsInterior, a.containsInterior(b));
+        }
+    }
+
+    TEST(RangeQuery, Sample2D) {
+        uniform_int_distribution<Point2::ElementType> coordsRange(-100, +100);
+
+        vector<Point2> v(2000);
+        for (auto &p: v) p = Point2({coordsRange(engine), coordsRange(engine)});
+
+        RangeQuery<Point2> rq(v, 4);
+        const Point2 from({-60, -40}), to({50, 70});
+        const auto all = rq.trivial(from, to);
+
+        // at least as many points as in the box: all of them
+        mt19937_64 rng(42);
+        auto s = rq.sample(from, to, all.size() + 10, rng);
+        sort(s.begin(), s.end());
+        ASSERT_EQ(all, s);
+
+        // distinct points of the box, reproducible with the same seed
+        for (size_t k: {size_t(0), size_t(1), size_t(17), all.size() / 2}) {
+            mt19937_64 rng1(k), rng2(k);
+            auto s1 = rq.sample(from, to, k, rng1);
+            auto s2 = rq.sample(from, to, k, rng2);
+
+            ASSERT_EQ(k, s1.size());
+            ASSERT_EQ(s1, s2);
+            sort(s1.begin(), s1.end());
+            ASSERT_TRUE(includes(all.begin(), all.end(), s1.begin(), s1.end()));
+        }
+    }
+
+    TEST(RangeQuery, SampleUniform1D) {
+        vector<Point1> v(1000);
+        for (size_t i = 0; i < v.size(); i++) v[i] = Point1(int(i));
+
+        // the box contains 100 points from leaves and canonical subtrees
+        RangeQuery<Point1> rq(v, 4);
+        mt19937_64 rng(7);
+        vector<size_t> counts(v.size());
+        constexpr size_t samples = 20000, k = 5;
+
+        for (size_t i = 0; i < samples; i++) {
+            for (const Point1 &p: rq.sample(Point1(450), Point1(549), k, rng)) counts[p[0]]++;
+        }
+        for (size_t i = 0; i < v.size(); i++) {
+            if (i < 450 || i > 549) {
+                ASSERT_EQ(size_t(0), counts[i]);
+            } else {
+                ASSERT_NEAR(double(samples * k / 100), double(counts[i]), samples * k / 100 * 0.15);
+            }
+        }
+    }
+
+    TEST(RangeQuery, RandomRadius2D) {
+        uniform_int_distribution<Point2::ElementType> coordsRange(-100, +100);
+        uniform_int_distribution<Point2::ElementType> radiusRange(0, 60);
+
+        vector<Point2> v(1000);
+        for (auto &p: v) p = Point2({coordsRange(engine), coordsRange(engine)});
+
+        RangeQuery<Point2> rq(v, 4);
+
+        for (size_t i = 0; i < 200; i++) {
+            const Point2 center({coordsRange(engine), coordsRange(engine)});
+            const int radius = radiusRange(engine);
+
+            for (Metric metric: {Metric::L2, Metric::LInf}) {
+                auto v2 = rq.efficientRadius(center, radius, metric);
+                sort(v2.begin(), v2.end());
+                ASSERT_EQ(rq.trivialRadius(center, radius, metric), v2);
+            }
+        }
+    }
+
+    TEST(RangeQuery, RandomRadius3D) {
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+        uniform_real_distribution<Point3::ElementType> radiusRange(0, 80);
+
+        vector<Point3> v(2000);
+        for (auto &p: v) p = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+
+        RangeQuery<Point3> rq(v, 4);
+        RangeQuery<Point3, BFloat16Key<double>> rqBFloat(v, 4);
+
+        for (size_t i = 0; i < 200; i++) {
+            const Point3 center({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+            const double radius = radiusRange(engine);
+            const auto expected = rq.trivialRadius(center, radius);
+
+            auto v2 = rq.efficientRadius(center, radius);
+            sort(v2.begin(), v2.end());
+            ASSERT_EQ(expected, v2);
+
+            v2 = rqBFloat.efficientRadius(center, radius);
+            sort(v2.begin(), v2.end());
+            ASSERT_EQ(expected, v2);
+        }
+    }
+
+    TEST(BoxJoin, Random2D) {
+        uniform_int_distribution<Point2::ElementType> coordsRange(-100, +100);
+
+        vector<Point2> points(2000), probes(500);
+        for (auto &p: points) p = Point2({coordsRange(engine), coordsRange(engine)});
+        for (auto &p: probes) p = Point2({coordsRange(engine), coordsRange(engine)});
+
+        // naive join: one query per probe
+        const Point2 halfExtent({5, 3});
+        RangeQuery<Point2> rq(points, 4);
+        vector<pair<Point2, Point2>> expected;
+
+        for (const Point2 &a: probes) {
+            for (const Point2 &b: rq.trivial(Point2({a[0] - 5, a[1] - 3}), Point2({a[0] + 5, a[1] + 3}))) {
+                expected.emplace_back(a, b);
+            }
+        }
+        sort(expected.begin(), expected.end());
+
+        for (unsigned threads: {1, 3}) {
+            for (size_t batchSize: {1, 7, 64}) {
+                vector<vector<pair<Point2, Point2>>> partitions(threads);
+
+                boxJoin(rq, probes, halfExtent, [&partitions](unsigned partition, const Point2 &a, const Point2 &b) {
+                    partitions[partition].emplace_back(a, b);
+                }, threads, batchSize);
+
+                vector<pair<Point2, Point2>> pairs;
+                for (const auto &partition: partitions) pairs.insert(pairs.end(), partition.begin(), partition.end());
+                sort(pairs.begin(), pairs.end());
+                ASSERT_EQ(expected, pairs);
+            }
+        }
+    }
+
+    TEST(VersionedRangeQuery, ConcurrentRebuilds2D) {
+        // all points of version k have x = k
+        auto version = [](int k) {
+            vector<Point2> points(100 + k);
+
+            for (size_t i = 0; i < points.size(); i++) points[i] = Point2({k, int(i)});
+            return points;
+        };
+
+        VersionedRangeQuery<Point2> vrq(version(1), 4);
+        atomic<bool> done{false};
+        vector<thread> readers;
+        vector<size_t> numOfQueries(4);
+
+        for (size_t t = 0; t < numOfQueries.size(); t++) {
+            readers.emplace_back([&, t]() {
+                while (!done) {
+                    const auto snapshot = vrq.snapshot();
+                    const int k = int(snapshot->number());
+                    const auto result = snapshot->query().efficient(Point2({-1000, -1000}), Point2({1000, 1000}));
+
+                    ASSERT_EQ(version(k).size(), result.size());
+                    for (const Point2 &p: result) ASSERT_EQ(k, p[0]);
+                    numOfQueries[t]++;
+                }
+            });
+        }
+        for (int k = 2; k <= 30; k++) {
+            vrq.rebuild(version(k)).get();
+            ASSERT_EQ(size_t(100 + k), vrq.efficient(Point2({-1000, -1000}), Point2({1000, 1000})).size());
+        }
+        done = true;
+        for (auto &reader: readers) reader.join();
+
+        ASSERT_EQ(size_t(0), vrq.reclaim());
+    }
+
+    TEST(VersionedRangeQuery, ReleasedByLastReader2D) {
+        auto version = [](int k) { return vector<Point2>(size_t(100 + k), Point2({k, k})); };
+        auto waitForReclaim = [](const VersionedRangeQuery<Point2> &vrq) {
+            for (int i = 0; i < 1000 && vrq.numOfRetired() > 0; i++) this_thread::sleep_for(chrono::milliseconds(1));
+            return vrq.numOfRetired();
+        };
+
+        VersionedRangeQuery<Point2> vrq(version(1), 4);
+
+        // the replaced versions are kept while readers use them and freed when the last one leaves, without reclaim()
+        for (int k = 2; k <= 5; k++) {
+            auto first = vrq.snapshot();
+            auto second = vrq.snapshot();
+
+            vrq.rebuild(version(k)).get();
+            ASSERT_EQ(size_t(1), vrq.numOfRetired());
+            ASSERT_EQ(uint64_t(k - 1), first->number());
+
+            { auto leaving = std::move(first); }
+            this_thread::sleep_for(2 * VersionedRangeQuery<Point2>::ReclaimInterval);
+            ASSERT_EQ(size_t(1), vrq.numOfRetired());
+            ASSERT_EQ(size_t(100 + k - 1), second->points().size());
+
+            { auto leaving = std::move(second); }
+            ASSERT_EQ(size_t(0), waitForReclaim(vrq));
+        }
+    }
+
+    TEST(VersionedRangeQuery, DiscardedRebuilds2D) {
+        auto version = [](int k) { return vector<Point2>(size_t(100 + k), Point2({k, k})); };
+
+        // discarded futures don't wait, and the index waits for its builder before it is destroyed
+        for (int n = 0; n < 10; n++) {
+            VersionedRangeQuery<Point2> vrq(version(0), 4);
+
+            for (int k = 1; k <= n; k++) vrq.rebuild(version(k));
+            if (n % 2 == 0) {
+                // the last rebuild supersedes all earlier ones
+                vrq.rebuild(version(n + 1)).get();
+                ASSERT_EQ(uint64_t(n + 2), vrq.snapshot()->number());
+                ASSERT_EQ(size_t(100 + n + 1), vrq.efficient(Point2({-1000, -1000}), Point2({1000, 1000})).size());
+            }
+        }
+    }
+
+    TEST(PointFile, RoundTrip3D) {
+        const string fileName = "RoundTrip3D.rqp";
+        uniform_real_distribution<Point3::ElementType> coordsRange(-100, +100);
+
+        vector<Point3> v(1000);
+        for (auto &p: v) p = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+        writePointFile(fileName, v);
+
+        ASSERT_EQ(v, readPointFile<Point3>(fileName, 7));
+        ASSERT_THROW(readPointFile<Point2>(fileName), runtime_error);
+
+        // the range query takes the points read from the file without copying them, and sorts them by x
+        RangeQuery<Point3> rq(readPointFile<Point3>(fileName), 4);
+        vector<Point3> points = rq.points();
+        ASSERT_TRUE(is_sorted(points.begin(), points.end(), [](const Point3 &a, const Point3 &b) {
+            return a[0] < b[0];
+        }));
+        sort(points.begin(), points.end());
+        sort(v.begin(), v.end());
+        ASSERT_EQ(v, points);
+        test(rq, Point3({-50, -20, 0}), Point3({30, 60, 70}));
+        remove(fileName.c_str());
+    }
+
+    TEST(Trace, RoundTrip3D) {
+        const string fileName = "RoundTrip3D.trc";
+        TraceRecorder<Point3> recorder({{4, 6, 4.5},
+                                        {1, 5, 4},
+                                        {-2.5, 7, 6}});
+        recorder.record({1, 1, 1.5}, {7, 7, 3});
+        recorder.record({-3, 0, 0}, {0, 7, 6});
+        recorder.save(fileName);
+
+        const Trace<Point3> trace = readTrace<Point3>(fileName);
+        ASSERT_EQ(recorder.trace().points, trace.points);
+        ASSERT_EQ(recorder.trace().boxes, trace.boxes);
+        ASSERT_THROW(readTrace<Point2>(fileName), runtime_error);
+        remove(fileName.c_str());
+    }
 }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <limits>
+#include <malloc.h>
+#include <string>
+#include <unistd.h>
+
+/// <summary>
+/// Return the resident set size of this process in bytes (Linux only, 0 elsewhere).
+/// </summary>
+inline size_t residentSetSize() {
+    size_t pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+
+    if (statm >> pages >> resident) return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return 0;
+}
+
+/// <summary>
+/// Return the number of heap bytes currently allocated by this process (glibc only, 0 elsewhere).
+/// Unlike the resident set size, freed memory kept by the allocator is not counted.
+/// </summary>
+inline size_t heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+/// <summary>
+/// Return the peak resident set size of this process in bytes since the start or the last reset (Linux only, 0
+/// elsewhere).
+/// </summary>
+inline size_t peakResidentSetSize() {
+    std::ifstream status("/proc/self/status");
+    std::string name;
+    size_t kiloBytes = 0;
+
+    while (status >> name) {
+        if (name == "VmHWM:" && status >> kiloBytes) return kiloBytes * 1024;
+        status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+/// <summary>
+/// Reset the peak resident set size to the current resident set size (Linux only).
+/// </summary>
+inline void resetPeakResidentSetSize() {
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "FileHeader.h"
+#include "Point.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Workload traces: a point set and a sequence of query boxes stored in a
+// compact binary file, so that a workload can be recorded once and replayed
+// against any RangeQuery backend.
+//
+// Layout (native byte order):
+//   FileHeader with magic "RQTR"
+//   uint64    number of points, followed by the points
+//   uint64    number of boxes, followed by the boxes (from, to)
+//
+
+template<class P>
+struct Trace {
+    std::vector<P> points;
+    std::vector<std::pair<P, P>> boxes;
+};
+
+inline constexpr char TraceMagic[] = "RQTR";
+
+/// <summary>
+/// Read the header of a trace file without loading the workload.
+/// </summary>
+inline FileHeader readTraceHeader(const std::string &fileName) {
+    std::ifstream is(fileName, std::ios::binary);
+    FileHeader header{};
+
+    if (!is.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        throw std::runtime_error("cannot read trace " + fileName);
+    }
+    return header;
+}
+
+template<class P>
+void writeTrace(const std::string &fileName, const Trace<P> &trace) {
+    std::ofstream os(fileName, std::ios::binary);
+    const FileHeader header = FileHeader::of<P>(TraceMagic);
+    const uint64_t numOfPoints = trace.points.size();
+    const uint64_t numOfBoxes = trace.boxes.size();
+
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char *>(&numOfPoints), sizeof(numOfPoints));
+    for (const P &p: trace.points) os.write(reinterpret_cast<const char *>(p.data()), sizeof(p[0]) * P::Dimension);
+    os.write(reinterpret_cast<const char *>(&numOfBoxes), sizeof(numOfBoxes));
+    for (const auto &[from, to]: trace.boxes) {
+        os.write(reinterpret_cast<const char *>(from.data()), sizeof(from[0]) * P::Dimension);
+        os.write(reinterpret_cast<const char *>(to.data()), sizeof(to[0]) * P::Dimension);
+    }
+
+    if (!os) throw std::runtime_error("cannot write trace " + fileName);
+}
+
+template<class P>
+Trace<P> readTrace(const std::string &fileName) {
+    std::ifstream is(fileName, std::ios::binary);
+    FileHeader header{};
+    uint64_t numOfPoints = 0, numOfBoxes = 0;
+    Trace<P> trace;
+
+    is.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!is || !(header == FileHeader::of<P>(TraceMagic))) throw std::runtime_error("not a matching trace " + fileName);
+
+    is.read(reinterpret_cast<char *>(&numOfPoints), sizeof(numOfPoints));
+    trace.points.resize(numOfPoints);
+    for (P &p: trace.points) is.read(reinterpret_cast<char *>(p.data()), sizeof(p[0]) * P::Dimension);
+
+    is.read(reinterpret_cast<char *>(&numOfBoxes), sizeof(numOfBoxes));
+    trace.boxes.resize(numOfBoxes);
+    for (auto &[from, to]: trace.boxes) {
+        is.read(reinterpret_cast<char *>(from.data()), sizeof(from[0]) * P::Dimension);
+        is.read(reinterpret_cast<char *>(to.data()), sizeof(to[0]) * P::Dimension);
+    }
+
+    if (!is) throw std::runtime_error("truncated trace " + fileName);
+    return trace;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Records the point set and every query box of a workload.
+template<class P>
+class TraceRecorder {
+    Trace<P> m_trace;
+
+public:
+    explicit TraceRecorder(const std::vector<P> &points) { m_trace.points = points; }
+
+    void record(const P &from, const P &to) { m_trace.boxes.emplace_back(from, to); }
+
+    const Trace<P> &trace() const { return m_trace; }
+
+    void save(const std::string &fileName) const { writeTrace(fileName, m_trace); }
+};
@@ -4,25 +4,54 @@
 
 #include <random>
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <string>
+#include <thread>
 #include "RangeQuery.h"
+#include "BoxJoin.h"
+#include "VersionedRangeQuery.h"
+#include "Memory.h"
+#include "PointFile.h"
+#include "Trace.h"
 
 using namespace std;
 
-int main() {
-    Stopwatch stopwatch;
-    default_random_engine engine;
-
+static vector<Point3> randomPoints(default_random_engine &engine, size_t numOfPoints) {
     uniform_real_distribution<double> coordsRange(-1000, 1000);
-    uniform_real_distribution<double> deltaRange(100, 200);
-
-    constexpr size_t numOfPoints = 50000;
-
     vector<Point3> points(numOfPoints);
 
     for (size_t i = 0; i < numOfPoints; i++) {
         points[i] = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
     }
+    return points;
+}
+
+static vector<pair<Point3, Point3>> randomBoxes(default_random_engine &engine, size_t numOfBoxes,
+                                               double minDelta = 100, double maxDelta = 200) {
+    uniform_real_distribution<double> coordsRange(-1000, 1000);
+    uniform_real_distribution<double> deltaRange(minDelta, maxDelta);
+    vector<pair<Point3, Point3>> boxes(numOfBoxes);
+
+    for (size_t i = 0; i < numOfBoxes; i++) {
+        auto p1x = coordsRange(engine);
+        auto p1y = coordsRange(engine);
+        auto p1z = coordsRange(engine);
+
+        auto p2x = p1x + deltaRange(engine);
+        auto p2y = p1y + deltaRange(engine);
+        auto p2z = p1z + deltaRange(engine);
+
+        boxes[i] = make_pair(Point3({p1x, p1y, p1z}), Point3({p2x, p2y, p2z}));
+    }
+    return boxes;
+}
+
+static void compareImplementations() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    const vector<Point3> points = randomPoints(engine, 50000);
 
     cout << "Starting the performance test for a trivial and efficient implementation for a range query." << endl << endl;
 
@@ -36,16 +65,8 @@ int main() {
     double elapsedTimeTrivial = 0;
     double elapsedTimeEfficient = 0;
 
-    for (int i = 0; i < 25000; i++) {
-        auto p1x = coordsRange(engine);
-        auto p1y = coordsRange(engine);
-        auto p1z = coordsRange(engine);
-
-        auto p2x = p1x + deltaRange(engine);
-        auto p2y = p1y + deltaRange(engine);
-        auto p2z = p1z + deltaRange(engine);
-
-        auto[trivial, efficient] = rangeQuery.performance(Point3({p1x, p1y, p1z}), Point3({p2x, p2y, p2z}));
+    for (const auto &[from, to]: randomBoxes(engine, 25000)) {
+        auto[trivial, efficient] = rangeQuery.performance(from, to);
 
         elapsedTimeTrivial += trivial;
         elapsedTimeEfficient += efficient;
@@ -57,7 +78,617 @@ int main() {
 
     cout << "The efficient implementation was roughly " << floor(elapsedTimeTrivial / elapsedTimeEfficient)
          << " times faster than the trivial implementation." << endl << endl;
+}
 
-    cout << "Performance test is finished" << endl;
+template<class E>
+static void measureKeyEncoding(const string &name, const vector<Point3> &points,
+                               const vector<pair<Point3, Point3>> &boxes, size_t leafSize) {
+    Stopwatch stopwatch;
+    const size_t heapBefore = heapInUse();
+
+    stopwatch.start();
+    RangeQuery<Point3, E> rangeQuery(points, leafSize);
+    stopwatch.stop();
+
+    const size_t heapAfter = heapInUse();
+    const double elapsedTimeBuild = stopwatch.getElapsedTimeSeconds();
+    size_t numOfResults = 0;
+
+    stopwatch.reset();
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) numOfResults += rangeQuery.efficient(from, to).size();
+    stopwatch.stop();
+
+    cout << name << ": key size " << sizeof(typename E::Key) << " bytes, inner nodes "
+         << sizeof(InnerNode<double, 3, E>) << '/' << sizeof(InnerNode<double, 2, E>) << '/'
+         << sizeof(InnerNode<double, 1, E>) << " bytes, build " << elapsedTimeBuild << " s, memory "
+         << (heapAfter - heapBefore) / (1024.0 * 1024.0) << " MiB, query latency "
+         << stopwatch.getElapsedTimeMilliseconds() * 1000 / boxes.size() << " us (" << numOfResults << " results)"
+         << endl;
+}
+
+static void compareKeyEncodings() {
+    default_random_engine engine;
+
+    const vector<Point3> points = randomPoints(engine, 50000);
+    const auto boxes = randomBoxes(engine, 25000);
+
+    cout << "Comparing the key encodings of the efficient implementation." << endl << endl;
+
+    // small leaves make the inner nodes a larger share of the trees
+    for (size_t leafSize: {DefaultLeafSize, size_t(4)}) {
+        cout << "leaf size " << leafSize << endl;
+        measureKeyEncoding<ExactKey<double>>("exact   ", points, boxes, leafSize);
+        measureKeyEncoding<FloatKey<double>>("float32 ", points, boxes, leafSize);
+        measureKeyEncoding<BFloat16Key<double>>("bfloat16", points, boxes, leafSize);
+        cout << endl;
+    }
+}
+
+static void compareLeafSizes() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    const vector<Point3> points = randomPoints(engine, 50000);
+    const auto boxes = randomBoxes(engine, 25000);
+
+    cout << "Comparing leaf bucket sizes of the efficient implementation." << endl << endl;
+
+    for (size_t leafSize = 1; leafSize <= 128; leafSize *= 2) {
+        const size_t heapBefore = heapInUse();
+
+        stopwatch.reset();
+        stopwatch.start();
+        RangeQuery<Point3> rangeQuery(points, leafSize);
+        stopwatch.stop();
+
+        const size_t heapAfter = heapInUse();
+        const double elapsedTimeBuild = stopwatch.getElapsedTimeSeconds();
+        size_t numOfResults = 0;
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) numOfResults += rangeQuery.efficient(from, to).size();
+        stopwatch.stop();
+
+        cout << "leaf size " << leafSize << ": build " << elapsedTimeBuild << " s, memory "
+             << (heapAfter - heapBefore) / (1024.0 * 1024.0) << " MiB, query latency "
+             << stopwatch.getElapsedTimeMilliseconds() * 1000 / boxes.size() << " us (" << numOfResults
+             << " results)" << endl;
+    }
+    cout << endl;
 }
 
+static void measureWideBoxes() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    const vector<Point3> points = randomPoints(engine, 200000);
+    RangeQuery<Point3> rangeQuery(points);
+
+    cout << "Measuring the efficient implementation on wide boxes." << endl << endl;
+
+    for (double delta: {200.0, 800.0, 1600.0}) {
+        const auto boxes = randomBoxes(engine, 2000, delta / 2, delta);
+        size_t numOfResults = 0;
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) numOfResults += rangeQuery.efficient(from, to).size();
+        stopwatch.stop();
+
+        cout << "box edges " << delta / 2 << ".." << delta << ": query latency "
+             << stopwatch.getElapsedTimeMilliseconds() * 1000 / boxes.size() << " us ("
+             << numOfResults / boxes.size() << " results per query)" << endl;
+    }
+
+    // correlated points along the diagonal: the bounding boxes of canonical subtrees are narrow in y and z
+    uniform_real_distribution<double> coordsRange(-1000, 1000);
+    normal_distribution<double> noise(0, 20);
+    vector<Point3> diagonal(points.size());
+
+    for (auto &p: diagonal) {
+        const double t = coordsRange(engine);
+        p = Point3({t, t + noise(engine), t + noise(engine)});
+    }
+
+    RangeQuery<Point3> diagonalQuery(diagonal);
+    size_t numOfResults = 0;
+
+    stopwatch.reset();
+    stopwatch.start();
+    for (size_t i = 0; i < 2000; i++) {
+        const double x = coordsRange(engine);
+        numOfResults += diagonalQuery.efficient(Point3({x, x - 200, x - 200}), Point3({x + 300, x + 500, x + 500})).size();
+    }
+    stopwatch.stop();
+
+    cout << "diagonal points, box edges 300..700: query latency " << stopwatch.getElapsedTimeMilliseconds() * 1000 / 2000
+         << " us (" << numOfResults / 2000 << " results per query)" << endl << endl;
+}
+
+static void compareReportThreads() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    uniform_real_distribution<double> marginRange(0, 200);
+    const vector<Point3> points = randomPoints(engine, 300000);
+    vector<pair<Point3, Point3>> boxes(20);
+    RangeQuery<Point3> rangeQuery(points);
+
+    // boxes covering most of the points
+    for (auto &[from, to]: boxes) {
+        from = Point3({-1000 + marginRange(engine), -1000 + marginRange(engine), -1000 + marginRange(engine)});
+        to = Point3({1000 - marginRange(engine), 1000 - marginRange(engine), 1000 - marginRange(engine)});
+    }
+
+    cout << "Comparing the number of threads reporting huge results (" << thread::hardware_concurrency()
+         << " hardware threads)." << endl << endl;
+
+    for (unsigned threads = 1; threads <= 32; threads *= 2) {
+        size_t numOfResults = 0;
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) numOfResults += rangeQuery.efficient(from, to, threads).size();
+        stopwatch.stop();
+
+        cout << threads << " thread(s): query latency " << stopwatch.getElapsedTimeMilliseconds() / boxes.size()
+             << " ms (" << numOfResults / boxes.size() << " results per query)" << endl;
+    }
+    cout << endl;
+}
+
+static void compareThreeSided() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+    uniform_int_distribution<int> coordsRange(-1000000, 1000000);
+    uniform_int_distribution<int> deltaRange(1000, 20000);
+
+    constexpr size_t numOfPoints = 200000;
+    constexpr size_t numOfBoxes = 20000;
+    vector<Point2> points(numOfPoints);
+    vector<pair<Point2, Point2>> boxes(numOfBoxes);
+
+    for (auto &p: points) p = Point2({coordsRange(engine), coordsRange(engine)});
+    for (auto &[from, to]: boxes) {
+        const int x = coordsRange(engine);
+        from = Point2({x, 990000});
+        to = Point2({x + deltaRange(engine), numeric_limits<int>::max()});
+    }
+
+    cout << "Comparing 3-sided queries (y >= c) on " << numOfPoints << " 2-dim points." << endl << endl;
+
+    size_t heapBefore = heapInUse();
+    RangeTree<int, 2> rangeTree(points);
+    const size_t memoryRangeTree = heapInUse() - heapBefore;
+
+    heapBefore = heapInUse();
+    PrioritySearchTree<int> pst(points);
+    const size_t memoryPst = heapInUse() - heapBefore;
+
+    size_t numOfResults = 0;
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) numOfResults += rangeTree.query(from, to).size();
+    stopwatch.stop();
+    cout << "range tree:            memory " << memoryRangeTree / (1024.0 * 1024.0) << " MiB, query latency "
+         << stopwatch.getElapsedTimeMilliseconds() * 1000 / numOfBoxes << " us (" << numOfResults << " results)"
+         << endl;
+
+    numOfResults = 0;
+    stopwatch.reset();
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) {
+        vector<Point2> result;
+        pst.query(from, to, result);
+        numOfResults += result.size();
+    }
+    stopwatch.stop();
+    cout << "priority search tree:  memory " << memoryPst / (1024.0 * 1024.0) << " MiB, query latency "
+         << stopwatch.getElapsedTimeMilliseconds() * 1000 / numOfBoxes << " us (" << numOfResults << " results)"
+         << endl << endl;
+}
+
+// measures one ingestion mode per process, because the peak resident set size can't be reset to the heap in use
+static void compareIngestion(const string &mode, AssocMode assocMode) {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    constexpr size_t numOfPoints = 1000000;
+    const string fileName = "ingest.rqp";
+
+    writePointFile(fileName, randomPoints(engine, numOfPoints));
+
+    vector<Point3> points = mode == "file" ? vector<Point3>() : readPointFile<Point3>(fileName);
+    const size_t rssBefore = residentSetSize();
+
+    resetPeakResidentSetSize();
+    stopwatch.start();
+    RangeQuery<Point3> rangeQuery(mode == "copy" ? points : mode == "move" ? move(points)
+                                                                          : readPointFile<Point3>(fileName), DefaultLeafSize,
+                                  assocMode);
+    stopwatch.stop();
+
+    cout << "Ingesting " << numOfPoints << " points (" << numOfPoints * sizeof(Point3) / (1024.0 * 1024.0)
+         << " MiB) by " << mode << (assocMode == AssocMode::Lazy ? " with lazy associated trees" : "") << ": build "
+         << stopwatch.getElapsedTimeSeconds() << " s, peak RSS during build +"
+         << (peakResidentSetSize() - rssBefore) / (1024.0 * 1024.0) << " MiB, RSS after build +"
+         << (residentSetSize() - rssBefore) / (1024.0 * 1024.0) << " MiB" << endl << endl;
+    remove(fileName.c_str());
+}
+
+static void compareSampling() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+    mt19937_64 rng(1);
+
+    const vector<Point3> points = randomPoints(engine, 300000);
+    RangeQuery<Point3> rangeQuery(points);
+    RangeQuery<Point3, BFloat16Key<double>> rangeQueryBFloat(points);
+
+    cout << "Comparing full queries and samples of 100 points on " << points.size() << " points." << endl << endl;
+
+    for (double delta: {200.0, 800.0, 1600.0}) {
+        const auto boxes = randomBoxes(engine, 200, delta / 2, delta);
+        size_t numOfResults = 0, numOfSamples = 0;
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) numOfResults += rangeQuery.efficient(from, to, 1).size();
+        stopwatch.stop();
+        const double elapsedTimeQuery = stopwatch.getElapsedTimeMilliseconds();
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) numOfSamples += rangeQuery.sample(from, to, 100, rng).size();
+        stopwatch.stop();
+        const double elapsedTimeSample = stopwatch.getElapsedTimeMilliseconds();
+
+        // inexact keys: only subtrees at boundary keys are verified
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) rangeQueryBFloat.sample(from, to, 100, rng);
+        stopwatch.stop();
+
+        cout << "box edges " << delta / 2 << ".." << delta << ": query " << elapsedTimeQuery * 1000 / boxes.size()
+             << " us (" << numOfResults / boxes.size() << " results), sample "
+             << elapsedTimeSample * 1000 / boxes.size() << " us (" << numOfSamples / boxes.size()
+             << " points), bfloat16 sample " << stopwatch.getElapsedTimeMilliseconds() * 1000 / boxes.size() << " us"
+             << endl;
+    }
+    cout << endl;
+}
+
+static void measureRebuilds() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    constexpr size_t numOfPoints = 200000;
+    const auto boxes = randomBoxes(engine, 1000);
+    VersionedRangeQuery<Point3> index(randomPoints(engine, numOfPoints));
+
+    cout << "Measuring queries of 2 reader threads while the index of " << numOfPoints << " points is rebuilt."
+         << endl << endl;
+
+    for (bool rebuilding: {false, true}) {
+        atomic<bool> done{false};
+        vector<vector<double>> latencies(2);
+        vector<thread> readers;
+
+        for (auto &latency: latencies) {
+            readers.emplace_back([&]() {
+                Stopwatch queryStopwatch;
+
+                for (size_t i = 0; !done; i++) {
+                    const auto &[from, to] = boxes[i % boxes.size()];
+
+                    queryStopwatch.reset();
+                    queryStopwatch.start();
+                    index.efficient(from, to, 1);
+                    queryStopwatch.stop();
+                    latency.push_back(queryStopwatch.getElapsedTimeMilliseconds() * 1000);
+                }
+            });
+        }
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (size_t i = 0; i < 3; i++) {
+            if (rebuilding) {
+                index.rebuild(randomPoints(engine, numOfPoints)).get();
+            } else {
+                this_thread::sleep_for(chrono::seconds(1));
+            }
+        }
+        stopwatch.stop();
+        done = true;
+        for (auto &reader: readers) reader.join();
+
+        // the builder thread frees the replaced versions after the readers have left
+        for (int i = 0; i < 1000 && index.numOfRetired() > 0; i++) this_thread::sleep_for(chrono::milliseconds(1));
+
+        vector<double> all;
+        for (const auto &latency: latencies) all.insert(all.end(), latency.begin(), latency.end());
+        sort(all.begin(), all.end());
+
+        cout << (rebuilding ? "3 rebuilds: " : "no rebuild: ") << stopwatch.getElapsedTimeSeconds() << " s, "
+             << all.size() << " queries, p50 " << all[all.size() / 2] << " us, p99 " << all[all.size() * 99 / 100]
+             << " us, max " << all.back() << " us, retired versions left " << index.numOfRetired() << endl;
+    }
+    cout << endl;
+}
+
+static void compareBitmaps() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+    uniform_real_distribution<double> marginRange(0, 400);
+
+    const vector<Point3> points = randomPoints(engine, 300000);
+    vector<pair<Point3, Point3>> boxes(50);
+
+    // boxes covering a large fraction of the points
+    for (auto &[from, to]: boxes) {
+        from = Point3({-1000 + marginRange(engine), -1000 + marginRange(engine), -1000 + marginRange(engine)});
+        to = Point3({1000 - marginRange(engine), 1000 - marginRange(engine), 1000 - marginRange(engine)});
+    }
+
+    cout << "Comparing point vectors and bitmaps as results of " << points.size() << " points." << endl << endl;
+
+    // the indices refer to the points sorted by x, hence the canonical subtrees of the x-tree are set as runs
+    RangeQuery<Point3> rangeQuery(points);
+    size_t numOfResults = 0;
+
+    stopwatch.reset();
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) numOfResults += rangeQuery.efficient(from, to, 1).size();
+    stopwatch.stop();
+    const double elapsedTimeVector = stopwatch.getElapsedTimeMilliseconds();
+
+    numOfResults = 0;
+    stopwatch.reset();
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) numOfResults += rangeQuery.efficientBitmap(from, to).count();
+    stopwatch.stop();
+    const double elapsedTimeBitmap = stopwatch.getElapsedTimeMilliseconds();
+
+    // intersection of two boxes
+    stopwatch.reset();
+    stopwatch.start();
+    const Bitmap both = rangeQuery.efficientBitmap(boxes[0].first, boxes[0].second) &
+                        rangeQuery.efficientBitmap(boxes[1].first, boxes[1].second);
+    stopwatch.stop();
+
+    cout << "vector " << elapsedTimeVector / boxes.size() << " ms, bitmap " << elapsedTimeBitmap / boxes.size()
+         << " ms (" << numOfResults / boxes.size() << " results per query), intersection of two queries "
+         << stopwatch.getElapsedTimeMilliseconds() << " ms (" << both.count() << " results)" << endl << endl;
+}
+
+static void compareBoxPredicates() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    const vector<Point3> points = randomPoints(engine, 1000000);
+    const vector<pair<Point3, Point3>> boxes = randomBoxes(engine, 20, 1000, 1400);
+
+    cout << "Comparing box predicates on " << points.size() << " random points." << endl << endl;
+
+    // the early exit branches on every coordinate: with about half of the points inside each coordinate range the
+    // branches are unpredictable
+    size_t numOfResults = 0;
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) {
+        for (const Point3 &p: points) {
+            dim_t i = 0;
+            while (i < Point3::Dimension && from[i] <= p[i] && p[i] <= to[i]) i++;
+            numOfResults += i == Point3::Dimension;
+        }
+    }
+    stopwatch.stop();
+    const double elapsedTimeEarlyExit = stopwatch.getElapsedTimeMilliseconds();
+
+    size_t numOfResultsBox = 0;
+    stopwatch.reset();
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) {
+        const Box<double, Point3::Dimension> box(from, to);
+        for (const Point3 &p: points) numOfResultsBox += box.contains(p);
+    }
+    stopwatch.stop();
+    const double elapsedTimeBox = stopwatch.getElapsedTimeMilliseconds();
+
+    RangeQuery<Point3> rangeQuery(points);
+    size_t numOfResultsTrivial = 0;
+    stopwatch.reset();
+    stopwatch.start();
+    for (const auto &[from, to]: boxes) numOfResultsTrivial += rangeQuery.trivial(from, to).size();
+    stopwatch.stop();
+
+    cout << "early exit " << elapsedTimeEarlyExit / boxes.size() << " ms, Box::contains "
+         << elapsedTimeBox / boxes.size() << " ms, trivial scan " << stopwatch.getElapsedTimeMilliseconds() / boxes.size()
+         << " ms per query (" << numOfResults / boxes.size() << " results per query)" << endl;
+    if (numOfResultsBox != numOfResults || numOfResultsTrivial != numOfResults) cerr << "Different results" << endl;
+    cout << endl;
+}
+
+static void compareAssocModes() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    const vector<Point3> points = randomPoints(engine, 200000);
+    const auto boxes = randomBoxes(engine, 1000);
+
+    cout << "Comparing eagerly and lazily built associated trees on " << points.size() << " points." << endl << endl;
+
+    for (AssocMode mode: {AssocMode::Eager, AssocMode::Lazy}) {
+        const size_t heapBefore = heapInUse();
+
+        stopwatch.reset();
+        stopwatch.start();
+        RangeQuery<Point3> rangeQuery(points, DefaultLeafSize, mode);
+        stopwatch.stop();
+        const double elapsedTimeBuild = stopwatch.getElapsedTimeSeconds();
+        const size_t heapBuilt = heapInUse();
+
+        stopwatch.reset();
+        stopwatch.start();
+        rangeQuery.efficient(boxes[0].first, boxes[0].second);
+        stopwatch.stop();
+        const double elapsedTimeFirst = stopwatch.getElapsedTimeMilliseconds();
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) rangeQuery.efficient(from, to);
+        stopwatch.stop();
+        const double elapsedTimeWarmUp = stopwatch.getElapsedTimeMilliseconds();
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const auto &[from, to]: boxes) rangeQuery.efficient(from, to);
+        stopwatch.stop();
+
+        cout << (mode == AssocMode::Eager ? "eager" : "lazy ") << ": startup " << elapsedTimeBuild << " s, memory "
+             << (heapBuilt - heapBefore) / (1024.0 * 1024.0) << " MiB, first query " << elapsedTimeFirst
+             << " ms, warm-up " << elapsedTimeWarmUp * 1000 / boxes.size() << " us per query, memory after warm-up "
+             << (heapInUse() - heapBefore) / (1024.0 * 1024.0) << " MiB, warm query latency "
+             << stopwatch.getElapsedTimeMilliseconds() * 1000 / boxes.size() << " us" << endl;
+    }
+    cout << endl;
+}
+
+static void compareRadius() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+    uniform_real_distribution<double> coordsRange(-1000, 1000);
+
+    const vector<Point3> points = randomPoints(engine, 200000);
+    RangeQuery<Point3> rangeQuery(points);
+
+    cout << "Comparing L2 radius queries on " << points.size() << " points." << endl << endl;
+
+    for (double radius: {50.0, 200.0, 800.0}) {
+        vector<Point3> centers(1000);
+        size_t numOfCandidates = 0, numOfResultsFiltered = 0, numOfResults = 0;
+
+        for (auto &c: centers) c = Point3({coordsRange(engine), coordsRange(engine), coordsRange(engine)});
+
+        // bounding box query, filtered by the distance afterwards
+        stopwatch.reset();
+        stopwatch.start();
+        for (const Point3 &c: centers) {
+            const auto candidates = rangeQuery.efficientRadius(c, radius, Metric::LInf);
+
+            numOfCandidates += candidates.size();
+            for (const Point3 &p: candidates) {
+                const double dx = p[0] - c[0], dy = p[1] - c[1], dz = p[2] - c[2];
+                numOfResultsFiltered += dx * dx + dy * dy + dz * dz <= radius * radius;
+            }
+        }
+        stopwatch.stop();
+        const double elapsedTimeFiltered = stopwatch.getElapsedTimeMilliseconds();
+
+        stopwatch.reset();
+        stopwatch.start();
+        for (const Point3 &c: centers) numOfResults += rangeQuery.efficientRadius(c, radius).size();
+        stopwatch.stop();
+
+        cout << "radius " << radius << ": box query and filter " << elapsedTimeFiltered * 1000 / centers.size()
+             << " us (" << numOfCandidates / centers.size() << " candidates), radius query "
+             << stopwatch.getElapsedTimeMilliseconds() * 1000 / centers.size() << " us ("
+             << numOfResults / centers.size() << " results, " << numOfResultsFiltered / centers.size()
+             << " filtered)" << endl;
+    }
+    cout << endl;
+}
+
+static void compareJoin() {
+    Stopwatch stopwatch;
+    default_random_engine engine;
+
+    const vector<Point3> points = randomPoints(engine, 200000);
+    const vector<Point3> probes = randomPoints(engine, 100000);
+    const Point3 halfExtent({20, 20, 20});
+    RangeQuery<Point3> rangeQuery(points);
+
+    cout << "Comparing a box join of " << probes.size() << " probes on " << points.size() << " points." << endl << endl;
+
+    size_t numOfPairs = 0;
+    stopwatch.start();
+    for (const Point3 &a: probes) {
+        const Point3 from({a[0] - halfExtent[0], a[1] - halfExtent[1], a[2] - halfExtent[2]});
+        const Point3 to({a[0] + halfExtent[0], a[1] + halfExtent[1], a[2] + halfExtent[2]});
+        numOfPairs += rangeQuery.efficient(from, to, 1).size();
+    }
+    stopwatch.stop();
+    cout << "naive per-point loop: " << stopwatch.getElapsedTimeSeconds() << " s (" << numOfPairs << " pairs)" << endl;
+
+    for (unsigned threads: {1u, max(2u, thread::hardware_concurrency())}) {
+        for (size_t batchSize: {1, 4, 16, 64}) {
+            vector<size_t> counts(threads);
+
+            stopwatch.reset();
+            stopwatch.start();
+            boxJoin(rangeQuery, probes, halfExtent, [&counts](unsigned partition, const Point3 &, const Point3 &) {
+                counts[partition]++;
+            }, threads, batchSize);
+            stopwatch.stop();
+
+            numOfPairs = 0;
+            for (size_t c: counts) numOfPairs += c;
+            cout << "box join, " << threads << " thread(s), batch " << batchSize << ": "
+                 << stopwatch.getElapsedTimeSeconds() << " s (" << numOfPairs << " pairs)" << endl;
+        }
+    }
+    cout << endl;
+}
+
+static void recordWorkload(const string &fileName) {
+    default_random_engine engine;
+    TraceRecorder<Point3> recorder(randomPoints(engine, 50000));
+
+    for (const auto &[from, to]: randomBoxes(engine, 25000)) recorder.record(from, to);
+    recorder.save(fileName);
+
+    cout << "Recorded " << recorder.trace().boxes.size() << " boxes on " << recorder.trace().points.size()
+         << " points to " << fileName << "." << endl << endl;
+}
+
+int main(int argc, char *argv[]) {
+    const string benchmark = argc > 1 ? argv[1] : "compare";
+
+    if (benchmark == "compare") {
+        compareImplementations();
+    } else if (benchmark == "encoding") {
+        compareKeyEncodings();
+    } else if (benchmark == "leafsize") {
+        compareLeafSizes();
+    } else if (benchmark == "wide") {
+        measureWideBoxes();
+    } else if (benchmark == "threads") {
+        compareReportThreads();
+    } else if (benchmark == "threesided") {
+        compareThreeSided();
+    } else if (benchmark == "ingest" && argc > 2) {
+        compareIngestion(argv[2], argc > 3 && string(argv[3]) == "lazy" ? AssocMode::Lazy : AssocMode::Eager);
+    } else if (benchmark == "sample") {
+        compareSampling();
+    } else if (benchmark == "rebuild") {
+        measureRebuilds();
+    } else if (benchmark == "bitmap") {
+        compareBitmaps();
+    } else if (benchmark == "lazy") {
+        compareAssocModes();
+    } else if (benchmark == "radius") {
+        compareRadius();
+    } else if (benchmark == "join") {
+        compareJoin();
+    } else if (benchmark == "box") {
+        compareBoxPredicates();
+    } else if (benchmark == "record" && argc > 2) {
+        recordWorkload(argv[2]);
+    } else {
+        cerr << "usage: " << argv[0] << " [compare|encoding|leafsize|wide|threads|threesided|ingest copy|move|file [lazy]|sample|rebuild|bitmap|lazy|radius|join|box|record <trace>]" << endl;
+        return 1;
+    }
+
+    cout << "Performance test is finished" << endl;
+}
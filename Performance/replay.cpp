@@ -0,0 +1,197 @@
+//
+// Replays a recorded workload trace against a RangeQuery backend and compares
+// the measured latencies and throughput to a stored baseline.
+//
+// usage: replay <trace> [--backend trivial|exact|float32|bfloat16] [--threads n] [--repeat n]
+//               [--save-baseline file] [--baseline file] [--threshold fraction]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RangeQuery.h"
+#include "Trace.h"
+
+using namespace std;
+
+struct Options {
+    string traceFile;
+    string backend = "exact";
+    unsigned threads = 1;
+    unsigned repeat = 1;
+    string baselineFile;
+    string saveBaselineFile;
+    double threshold = 0.1;
+};
+
+struct Report {
+    double p50 = 0, p99 = 0, p999 = 0;  // latencies in microseconds
+    double throughput = 0;              // queries per second
+
+    friend ostream &operator<<(ostream &os, const Report &r) {
+        return os << "p50 " << r.p50 << "\np99 " << r.p99 << "\np999 " << r.p999 << "\nthroughput " << r.throughput
+                  << "\n";
+    }
+
+    friend istream &operator>>(istream &is, Report &r) {
+        string name;
+        double value;
+
+        while (is >> name >> value) {
+            if (name == "p50") r.p50 = value;
+            else if (name == "p99") r.p99 = value;
+            else if (name == "p999") r.p999 = value;
+            else if (name == "throughput") r.throughput = value;
+        }
+        return is;
+    }
+};
+
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+/// <summary>
+/// Run all boxes of the trace 'repeat' times on 'threads' threads and collect the latency of every query.
+/// </summary>
+template<class P, class Query>
+static Report run(const Trace<P> &trace, const Options &options, Query query) {
+    using Clock = chrono::steady_clock;
+
+    const size_t numOfQueries = trace.boxes.size() * options.repeat;
+    vector<double> latencies(numOfQueries);
+    atomic<size_t> next{0};
+    vector<thread> workers;
+
+    const auto start = Clock::now();
+    for (unsigned t = 0; t < options.threads; t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < numOfQueries; i = next++) {
+                const auto &[from, to] = trace.boxes[i % trace.boxes.size()];
+                const auto begin = Clock::now();
+
+                query(from, to);
+                latencies[i] = chrono::duration<double, micro>(Clock::now() - begin).count();
+            }
+        });
+    }
+    for (auto &worker: workers) worker.join();
+    const double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+    sort(latencies.begin(), latencies.end());
+
+    Report report;
+    report.p50 = percentile(latencies, 0.5);
+    report.p99 = percentile(latencies, 0.99);
+    report.p999 = percentile(latencies, 0.999);
+    report.throughput = elapsed > 0 ? numOfQueries / elapsed : 0;
+    return report;
+}
+
+template<class P>
+static Report replay(const Options &options) {
+    const Trace<P> trace = readTrace<P>(options.traceFile);
+    using T = typename P::ElementType;
+
+    cout << "Replaying " << trace.boxes.size() << " boxes on " << trace.points.size() << " points with backend '"
+         << options.backend << "' on " << options.threads << " thread(s)." << endl;
+
+    if (options.backend == "trivial") {
+        RangeQuery<P> rq(trace.points);
+        return run(trace, options, [&rq](const P &from, const P &to) { return rq.trivial(from, to); });
+    } else if (options.backend == "exact") {
+        RangeQuery<P, ExactKey<T>> rq(trace.points);
+        return run(trace, options, [&rq](const P &from, const P &to) { return rq.efficient(from, to); });
+    } else if (options.backend == "float32") {
+        RangeQuery<P, FloatKey<T>> rq(trace.points);
+        return run(trace, options, [&rq](const P &from, const P &to) { return rq.efficient(from, to); });
+    } else if (options.backend == "bfloat16") {
+        RangeQuery<P, BFloat16Key<T>> rq(trace.points);
+        return run(trace, options, [&rq](const P &from, const P &to) { return rq.efficient(from, to); });
+    }
+    throw invalid_argument("unknown backend " + options.backend);
+}
+
+/// <summary>
+/// Return true if the report is within the threshold of the baseline.
+/// </summary>
+static bool compare(const Report &report, const Report &baseline, double threshold) {
+    bool passed = true;
+    auto check = [&](const string &name, double value, double base, bool higherIsBetter) {
+        const bool ok = higherIsBetter ? value >= base * (1 - threshold) : value <= base * (1 + threshold);
+
+        cout << (ok ? "  ok   " : "  FAIL ") << name << ": " << value << " (baseline " << base << ")" << endl;
+        passed &= ok;
+    };
+
+    check("p50", report.p50, baseline.p50, false);
+    check("p99", report.p99, baseline.p99, false);
+    check("p999", report.p999, baseline.p999, false);
+    check("throughput", report.throughput, baseline.throughput, true);
+    return passed;
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--backend" && hasValue) options.backend = argv[++i];
+        else if (arg == "--threads" && hasValue) options.threads = max(1, stoi(argv[++i]));
+        else if (arg == "--repeat" && hasValue) options.repeat = max(1, stoi(argv[++i]));
+        else if (arg == "--baseline" && hasValue) options.baselineFile = argv[++i];
+        else if (arg == "--save-baseline" && hasValue) options.saveBaselineFile = argv[++i];
+        else if (arg == "--threshold" && hasValue) options.threshold = stod(argv[++i]);
+        else if (options.traceFile.empty() && arg[0] != '-') options.traceFile = arg;
+        else {
+            cerr << "unknown argument " << arg << endl;
+            return 2;
+        }
+    }
+    if (options.traceFile.empty()) {
+        cerr << "usage: " << argv[0] << " <trace> [--backend trivial|exact|float32|bfloat16] [--threads n]"
+             << " [--repeat n] [--save-baseline file] [--baseline file] [--threshold fraction]" << endl;
+        return 2;
+    }
+
+    try {
+        const FileHeader header = readTraceHeader(options.traceFile);
+        Report report;
+
+        if (header == FileHeader::of<Point1>(TraceMagic)) report = replay<Point1>(options);
+        else if (header == FileHeader::of<Point2>(TraceMagic)) report = replay<Point2>(options);
+        else if (header == FileHeader::of<Point3>(TraceMagic)) report = replay<Point3>(options);
+        else throw runtime_error("unsupported point type in trace " + options.traceFile);
+
+        cout << endl << report;
+
+        if (!options.saveBaselineFile.empty()) {
+            ofstream(options.saveBaselineFile) << report;
+        }
+        if (!options.baselineFile.empty()) {
+            ifstream is(options.baselineFile);
+            Report baseline;
+
+            is >> baseline;
+            if (baseline.throughput <= 0) throw runtime_error("invalid baseline " + options.baselineFile);
+
+            cout << endl << "Comparison to baseline (threshold " << options.threshold * 100 << "%):" << endl;
+            if (!compare(report, baseline, options.threshold)) {
+                cout << "Performance regression detected." << endl;
+                return 1;
+            }
+            cout << "No performance regression." << endl;
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 2;
+    }
+}
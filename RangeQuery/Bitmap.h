@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Plain bitmap over the indices [0, size) of the points of a tree.
+// Query results in bitmap mode set the bits of the indices of the points
+// inside the query box. Bitmaps of the same tree are combined with & and |
+// without materialising any points.
+//
+
+class Bitmap {
+    std::vector<uint64_t> m_words;
+    size_t m_size;
+
+public:
+    explicit Bitmap(size_t size = 0) : m_words((size + 63) / 64), m_size(size) {}
+
+    size_t size() const { return m_size; }
+
+    bool test(size_t i) const { return (m_words[i >> 6] >> (i & 63)) & 1; }
+
+    void set(size_t i) { m_words[i >> 6] |= uint64_t(1) << (i & 63); }
+
+    // sets bit i if value is true, without branching on value
+    void set(size_t i, bool value) { m_words[i >> 6] |= uint64_t(value) << (i & 63); }
+
+    /// <summary>
+    /// Set the bits [beg, end).
+    /// </summary>
+    void setRange(size_t beg, size_t end) {
+        if (beg >= end) return;
+
+        const size_t first = beg >> 6, last = (end - 1) >> 6;
+        const uint64_t firstMask = ~uint64_t(0) << (beg & 63);
+        const uint64_t lastMask = ~uint64_t(0) >> (63 - ((end - 1) & 63));
+
+        if (first == last) {
+            m_words[first] |= firstMask & lastMask;
+        } else {
+            m_words[first] |= firstMask;
+            std::fill(m_words.begin() + first + 1, m_words.begin() + last, ~uint64_t(0));
+            m_words[last] |= lastMask;
+        }
+    }
+
+    /// <summary>
+    /// Return the number of set bits.
+    /// </summary>
+    size_t count() const {
+        size_t n = 0;
+
+        for (uint64_t w: m_words) n += __builtin_popcountll(w);
+        return n;
+    }
+
+    /// <summary>
+    /// Call f(i) for all set bits i in increasing order.
+    /// </summary>
+    template<class F>
+    void forEach(F &&f) const {
+        for (size_t i = 0; i < m_words.size(); i++) {
+            for (uint64_t w = m_words[i]; w; w &= w - 1) f(i * 64 + __builtin_ctzll(w));
+        }
+    }
+
+    std::vector<size_t> indices() const {
+        std::vector<size_t> result;
+
+        result.reserve(count());
+        forEach([&result](size_t i) { result.push_back(i); });
+        return result;
+    }
+
+    Bitmap &operator&=(const Bitmap &rhs) {
+        for (size_t i = 0; i < m_words.size(); i++) m_words[i] &= rhs.m_words[i];
+        return *this;
+    }
+
+    Bitmap &operator|=(const Bitmap &rhs) {
+        for (size_t i = 0; i < m_words.size(); i++) m_words[i] |= rhs.m_words[i];
+        return *this;
+    }
+
+    friend Bitmap operator&(Bitmap lhs, const Bitmap &rhs) { return lhs &= rhs; }
+
+    friend Bitmap operator|(Bitmap lhs, const Bitmap &rhs) { return lhs |= rhs; }
+
+    bool operator==(const Bitmap &rhs) const { return m_size == rhs.m_size && m_words == rhs.m_words; }
+};
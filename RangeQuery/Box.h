@@ -0,0 +1,85 @@
+#pragma once
+
+#include <utility>
+#include "Point.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Closed axis-parallel box [lo, hi].
+// The predicates are unrolled at compile time over the D coordinates and
+// combine the comparisons with & instead of &&, so that they compile to a
+// fixed sequence of compares without data-dependent branches. This matters
+// for scans of random data, where an early exit mispredicts about every
+// second point.
+//
+
+template<typename T, dim_t D>
+struct Box {
+    Point<T, D> lo, hi;
+
+    Box() = default;
+
+    Box(const Point<T, D> &from, const Point<T, D> &to) : lo(from), hi(to) {}
+
+    /// <summary>
+    /// Return true if p lies inside the box.
+    /// </summary>
+    bool contains(const Point<T, D> &p) const {
+        return contains(p, std::make_index_sequence<D>());
+    }
+
+    /// <summary>
+    /// Return true if the box and b have at least one point in common.
+    /// </summary>
+    bool intersects(const Box &b) const {
+        return intersects(b, std::make_index_sequence<D>());
+    }
+
+    /// <summary>
+    /// Return true if b lies completely inside the box.
+    /// </summary>
+    bool containsBox(const Box &b) const {
+        return containsBox(b, std::make_index_sequence<D>());
+    }
+
+    /// <summary>
+    /// Return true if b lies completely inside the interior of the box, i.e. doesn't touch its boundary.
+    /// </summary>
+    bool containsInterior(const Box &b) const {
+        return containsInterior(b, std::make_index_sequence<D>());
+    }
+
+    /// <summary>
+    /// Return the box spanned by the last L coordinates.
+    /// </summary>
+    template<dim_t L>
+    Box<T, L> last() const {
+        Box<T, L> b;
+
+        for (dim_t i = 0; i < L; i++) {
+            b.lo[i] = lo[D - L + i];
+            b.hi[i] = hi[D - L + i];
+        }
+        return b;
+    }
+
+private:
+    template<size_t... I>
+    bool contains(const Point<T, D> &p, std::index_sequence<I...>) const {
+        return (true & ... & ((lo[I] <= p[I]) & (p[I] <= hi[I])));
+    }
+
+    template<size_t... I>
+    bool intersects(const Box &b, std::index_sequence<I...>) const {
+        return (true & ... & ((lo[I] <= b.hi[I]) & (b.lo[I] <= hi[I])));
+    }
+
+    template<size_t... I>
+    bool containsBox(const Box &b, std::index_sequence<I...>) const {
+        return (true & ... & ((lo[I] <= b.lo[I]) & (b.hi[I] <= hi[I])));
+    }
+
+    template<size_t... I>
+    bool containsInterior(const Box &b, std::index_sequence<I...>) const {
+        return (true & ... & ((lo[I] < b.lo[I]) & (b.hi[I] < hi[I])));
+    }
+};
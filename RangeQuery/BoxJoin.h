@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "Box.h"
+#include "RangeQuery.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Box join: reports every pair (a, b) of a probe a and an indexed point b with
+// a - halfExtent <= b <= a + halfExtent.
+// The probes are sorted along a Z-order curve, so that consecutive probes are
+// close in space. A batch of consecutive probes shares one traversal of the
+// range tree with the union of their boxes, then each probe picks its partners
+// from the candidates of the batch. Batches are handed out to the threads
+// dynamically.
+// The sink is called as sink(partition, a, b), where partition is the index of
+// the calling thread (0 <= partition < threads). Calls with different
+// partitions run concurrently, calls with the same partition never do.
+//
+
+/// <summary>
+/// Return the Z-order (Morton) code of p within the box [lo, hi].
+/// </summary>
+template<class P>
+uint64_t mortonCode(const P &p, const P &lo, const P &hi) {
+    constexpr unsigned bits = std::min(32u, 64u / P::Dimension);
+    constexpr double cells = static_cast<double>((uint64_t(1) << bits) - 1);
+    std::array<uint64_t, P::Dimension> cell{};
+
+    for (dim_t i = 0; i < P::Dimension; i++) {
+        const double extent = static_cast<double>(hi[i]) - static_cast<double>(lo[i]);
+        if (extent > 0) cell[i] = static_cast<uint64_t>((static_cast<double>(p[i]) - lo[i]) / extent * cells);
+    }
+
+    uint64_t code = 0;
+    for (unsigned b = bits; b-- > 0;) {
+        for (dim_t i = 0; i < P::Dimension; i++) code = (code << 1) | ((cell[i] >> b) & 1);
+    }
+    return code;
+}
+
+template<class P, class E, class Sink>
+void boxJoin(const RangeQuery<P, E> &index, std::vector<P> probes, const P &halfExtent, Sink &&sink,
+             unsigned threads = 0, size_t batchSize = 16) {
+    if (probes.empty()) return;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    batchSize = std::max<size_t>(batchSize, 1);
+
+    // sort the probes along the Z-order curve of their bounding box
+    P lo = probes.front(), hi = probes.front();
+    for (const P &a: probes) {
+        for (dim_t i = 0; i < P::Dimension; i++) {
+            lo[i] = std::min(lo[i], a[i]);
+            hi[i] = std::max(hi[i], a[i]);
+        }
+    }
+
+    std::vector<std::pair<uint64_t, P>> sorted(probes.size());
+    std::transform(probes.begin(), probes.end(), sorted.begin(),
+                   [&lo, &hi](const P &a) { return std::make_pair(mortonCode(a, lo, hi), a); });
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    std::transform(sorted.begin(), sorted.end(), probes.begin(), [](const auto &a) { return a.second; });
+    sorted = {};
+
+    const size_t numOfBatches = (probes.size() + batchSize - 1) / batchSize;
+    std::atomic<size_t> nextBatch{0};
+
+    auto worker = [&](unsigned partition) {
+        std::vector<P> candidates;
+
+        for (size_t batch = nextBatch++; batch < numOfBatches; batch = nextBatch++) {
+            const auto beg = probes.begin() + batch * batchSize;
+            const auto end = probes.begin() + std::min(probes.size(), (batch + 1) * batchSize);
+
+            // one traversal for the union of the boxes of the batch
+            P from = *beg, to = *beg;
+            for (auto it = beg; it != end; ++it) {
+                for (dim_t i = 0; i < P::Dimension; i++) {
+                    from[i] = std::min(from[i], (*it)[i]);
+                    to[i] = std::max(to[i], (*it)[i]);
+                }
+            }
+            for (dim_t i = 0; i < P::Dimension; i++) {
+                from[i] -= halfExtent[i];
+                to[i] += halfExtent[i];
+            }
+
+            candidates = index.efficient(from, to, 1);
+            std::sort(candidates.begin(), candidates.end(), [](const P &a, const P &b) { return a[0] < b[0]; });
+
+            // each probe scans the candidates inside its box in the first coordinate
+            for (auto it = beg; it != end; ++it) {
+                const P &a = *it;
+                Box<typename P::ElementType, P::Dimension> box(a, a);
+
+                for (dim_t i = 0; i < P::Dimension; i++) {
+                    box.lo[i] -= halfExtent[i];
+                    box.hi[i] += halfExtent[i];
+                }
+
+                auto b = std::lower_bound(candidates.begin(), candidates.end(), box.lo[0],
+                                          [](const P &p, const typename P::ElementType &v) { return p[0] < v; });
+                for (; b != candidates.end() && (*b)[0] <= box.hi[0]; ++b) {
+                    if (box.contains(*b)) sink(partition, a, *b);
+                }
+            }
+        }
+    };
+
+    if (threads == 1) {
+        worker(0);
+    } else {
+        std::vector<std::thread> workers;
+
+        for (unsigned t = 0; t < threads; t++) workers.emplace_back(worker, t);
+        for (auto &w: workers) w.join();
+    }
+}
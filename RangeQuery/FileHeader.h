@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+///////////////////////////////////////////////////////////////////////////////
+// Header of the binary files of point sets and workload traces: the magic of
+// the file kind and the layout of the stored points.
+//
+// Layout (native byte order):
+//   char[4]   magic
+//   uint8     version
+//   uint8     dimension
+//   uint8     element kind (0 = integer, 1 = floating point)
+//   uint8     element size in bytes
+//
+
+struct FileHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t dimension;
+    uint8_t elementKind;
+    uint8_t elementSize;
+
+    /// <summary>
+    /// Return the header of a file with the given magic and points of type P.
+    /// </summary>
+    template<class P>
+    static FileHeader of(const char (&magic)[5]) {
+        using T = typename P::ElementType;
+        return {{magic[0], magic[1], magic[2], magic[3]}, 1, P::Dimension,
+                std::numeric_limits<T>::is_integer ? uint8_t(0) : uint8_t(1), sizeof(T)};
+    }
+
+    bool operator==(const FileHeader &rhs) const {
+        return std::equal(magic, magic + 4, rhs.magic) && version == rhs.version && dimension == rhs.dimension &&
+               elementKind == rhs.elementKind && elementSize == rhs.elementSize;
+    }
+};
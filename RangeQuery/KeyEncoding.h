@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include "Box.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Key encodings for the search keys stored inside a RangeTree.
+// An encoding maps a coordinate of type T non-decreasingly to a key of type
+// Key, i.e. a <= b implies encode(a) <= encode(b). An inexact encoding may map
+// different coordinates to the same key. The tree then navigates on keys,
+// which yields a superset of the result, and verifies the full-precision
+// coordinates of every reported point.
+// Trees are navigated with closed key intervals, so that the largest
+// coordinate needs no key beyond it.
+// lower(k) and upper(k) bound all coordinates with key k:
+// encode(a) == k implies lower(k) <= a <= upper(k).
+//
+
+///////////////////////////////////////////////////////////////////////////////
+// Keys are full copies of the coordinates.
+template<typename T>
+struct ExactKey {
+    using Key = T;
+    static constexpr bool exact = true;
+
+    static Key encode(const T &value) { return value; }
+
+    static T lower(const Key &key) { return key; }
+
+    static T upper(const Key &key) { return key; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Keys are coordinates rounded to single precision (4 bytes).
+template<typename T>
+struct FloatKey {
+    using Key = float;
+    static constexpr bool exact = std::is_same<T, float>::value;
+
+    static Key encode(const T &value) { return static_cast<float>(value); }
+
+    // coordinates are rounded to the nearest float, hence they lie strictly between the neighbours of their key
+    static float lower(const Key &key) {
+        return exact ? key : std::nextafter(key, -std::numeric_limits<float>::infinity());
+    }
+
+    static float upper(const Key &key) {
+        return exact ? key : std::nextafter(key, std::numeric_limits<float>::infinity());
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Keys are the upper 16 bits of the single precision coordinates (bfloat16),
+// stored as unsigned integers whose order matches the order of the floats.
+template<typename T>
+struct BFloat16Key {
+    using Key = uint16_t;
+    static constexpr bool exact = false;
+
+    static Key encode(const T &value) {
+        float f = static_cast<float>(value);
+        if (f == 0) f = 0;  // -0 and +0 must get the same key
+
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+
+        // negative floats: reverse order of the magnitudes, positive floats: move above the negative ones
+        bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+        return static_cast<Key>(bits >> 16);
+    }
+
+    // the floats with key k have the ordered bits [k << 16, k << 16 | 0xFFFF]
+    static float lower(const Key &key) {
+        constexpr float inf = std::numeric_limits<float>::infinity();
+        const float f = decode(static_cast<uint32_t>(key) << 16);
+
+        return std::isnan(f) ? -inf : std::nextafter(f, -inf);
+    }
+
+    static float upper(const Key &key) {
+        constexpr float inf = std::numeric_limits<float>::infinity();
+        const float f = decode(static_cast<uint32_t>(key) << 16 | 0xFFFFu);
+
+        return std::isnan(f) ? inf : std::nextafter(f, inf);
+    }
+
+private:
+    static float decode(uint32_t bits) {
+        bits = (bits & 0x80000000u) ? bits & 0x7FFFFFFFu : ~bits;
+
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Encodes the corners of a box. Encodings are non-decreasing, hence the keys
+// of all points inside the box lie inside the encoded box.
+template<class E, typename T, dim_t D>
+Box<typename E::Key, D> encodeBox(const Box<T, D> &box) {
+    Box<typename E::Key, D> keys;
+
+    for (dim_t i = 0; i < D; i++) {
+        keys.lo[i] = E::encode(box.lo[i]);
+        keys.hi[i] = E::encode(box.hi[i]);
+    }
+    return keys;
+}
@@ -2,10 +2,13 @@
 // Author: Yannick Huggler
 //
 
+#pragma once
+
 #include <cstdint>
 #include <array>
-#include <cmath>
+#include <functional>
 #include <ostream>
+#include <utility>
 
 typedef uint8_t dim_t;
 
@@ -18,27 +21,15 @@ public:
     static constexpr dim_t Dimension = d;
 
     Point(T dimension = 0) {
+        this->fill(0);
         (*this)[0] = dimension;
     }
 
     Point(std::initializer_list<T> dimensions) {
+        this->fill(0);
         std::copy(dimensions.begin(), dimensions.end(), this->begin());
     }
 
-    Point nextAfter() const {
-        std::initializer_list<T> newDimensions;
-        Point<T, d> point(newDimensions);
-
-        for (int i = 0; i < this->size(); i++) {
-            if (std::numeric_limits<T>::is_integer) {
-                point[i] = (*this)[i] + 1;
-            } else {
-                point[i] = std::nextafter((*this)[i], std::numeric_limits<T>::max());
-            }
-        }
-        return point;
-    }
-
     bool operator==(const Point &rhs) const {
         if (this->Dimension != rhs.Dimension) return false;
 
@@ -52,18 +43,13 @@ public:
         return std::lexicographical_compare(this->begin(), this->end(), rhs.begin(), rhs.end());
     }
 
+    // component-wise comparisons, unrolled and without early exit (see Box)
     bool operator<=(const Point &rhs) const {
-        int i = 0;
-        while (i < this->size() && (*this)[i] <= rhs[i]) i++;
-
-        return i == this->size();
+        return all(rhs, std::less_equal<T>(), std::make_index_sequence<d>());
     }
 
     bool operator>=(const Point &rhs) const {
-        int i = 0;
-        while (i < this->size() && (*this)[i] >= rhs[i]) i++;
-
-        return i == this->size();
+        return all(rhs, std::greater_equal<T>(), std::make_index_sequence<d>());
     }
 
     friend std::ostream &operator<<(std::ostream &os, const Point &point) {
@@ -76,6 +62,12 @@ public:
 
         return os << ")";
     }
+
+private:
+    template<class Compare, size_t... I>
+    bool all(const Point &rhs, Compare compare, std::index_sequence<I...>) const {
+        return (true & ... & compare((*this)[I], rhs[I]));
+    }
 };
 
 typedef Point<int, 1> Point1;
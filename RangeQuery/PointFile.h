@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "FileHeader.h"
+#include "Point.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Point files: a point set stored as a plain binary array, which is read in
+// chunks directly into the vector a RangeQuery takes ownership of, so that
+// ingestion needs no staging copy of the points.
+//
+// Layout (native byte order):
+//   FileHeader with magic "RQPT"
+//   uint64    number of points, followed by the points
+//
+
+inline constexpr char PointFileMagic[] = "RQPT";
+
+template<class P>
+void writePointFile(const std::string &fileName, const std::vector<P> &points) {
+    static_assert(sizeof(P) == sizeof(typename P::ElementType) * P::Dimension, "points must be packed");
+
+    std::ofstream os(fileName, std::ios::binary);
+    const FileHeader header = FileHeader::of<P>(PointFileMagic);
+    const uint64_t numOfPoints = points.size();
+
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char *>(&numOfPoints), sizeof(numOfPoints));
+    os.write(reinterpret_cast<const char *>(points.data()), static_cast<std::streamsize>(sizeof(P) * points.size()));
+
+    if (!os) throw std::runtime_error("cannot write point file " + fileName);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the points of a point file in chunks.
+template<class P>
+class PointFileReader {
+    static_assert(sizeof(P) == sizeof(typename P::ElementType) * P::Dimension, "points must be packed");
+
+    std::ifstream m_is;
+    uint64_t m_size = 0;
+    uint64_t m_numOfRead = 0;
+    std::string m_fileName;
+
+public:
+    explicit PointFileReader(const std::string &fileName) : m_is(fileName, std::ios::binary), m_fileName(fileName) {
+        FileHeader header{};
+
+        m_is.read(reinterpret_cast<char *>(&header), sizeof(header));
+        m_is.read(reinterpret_cast<char *>(&m_size), sizeof(m_size));
+        if (!m_is || !(header == FileHeader::of<P>(PointFileMagic))) {
+            throw std::runtime_error("not a matching point file " + fileName);
+        }
+    }
+
+    // number of points in the file
+    uint64_t size() const { return m_size; }
+
+    /// <summary>
+    /// Read up to 'count' points to out and return the number of points read, 0 at the end of the file.
+    /// </summary>
+    size_t read(P *out, size_t count) {
+        count = static_cast<size_t>(std::min<uint64_t>(count, m_size - m_numOfRead));
+        m_is.read(reinterpret_cast<char *>(out), static_cast<std::streamsize>(sizeof(P) * count));
+        if (!m_is) throw std::runtime_error("truncated point file " + m_fileName);
+
+        m_numOfRead += count;
+        return count;
+    }
+};
+
+/// <summary>
+/// Return all points of a point file, read in chunks of 'chunkSize' points.
+/// </summary>
+template<class P>
+std::vector<P> readPointFile(const std::string &fileName, size_t chunkSize = 1 << 16) {
+    PointFileReader<P> reader(fileName);
+    std::vector<P> points(reader.size());
+
+    for (size_t pos = 0; pos < points.size();) pos += reader.read(points.data() + pos, chunkSize);
+    return points;
+}
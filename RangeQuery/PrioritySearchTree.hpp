@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Box.h"
+#include "Point.h"
+#include "RangeTree.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Priority search tree (McCreight) for 2-dim points.
+// Answers 3-sided queries [x1, x2] x [y, inf) in O(log n + k) time with O(n)
+// memory. Each node stores the point with the largest y-coordinate of its
+// subtree (heap order) and splits the remaining points at the median
+// x-coordinate (search tree order).
+// Y is the heap coordinate, the other coordinate is the search coordinate.
+// If Max is false, the heap order is reversed and the tree answers
+// [x1, x2] x (-inf, y] instead.
+// Duplicates are correctly handled.
+//
+
+template<typename T, dim_t Y = 1, bool Max = true>
+class PrioritySearchTree {
+    static_assert(Y < 2, "heap coordinate must be 0 or 1");
+    static constexpr dim_t X = 1 - Y;
+    static constexpr uint32_t None = std::numeric_limits<uint32_t>::max();
+
+    using P = Point<T, 2>;
+    using PIt = typename std::vector<P>::iterator;
+
+    struct Node {
+        P point;            // point of the subtree with the highest priority
+        T split;            // largest search coordinate in the left subtree
+        uint32_t left, right;
+    };
+
+    std::vector<Node> m_nodes;
+
+    static bool precedes(const T &a, const T &b) { return Max ? b < a : a < b; }
+
+public:
+    explicit PrioritySearchTree(std::vector<P> points) {
+        std::sort(points.begin(), points.end(), [](const P &a, const P &b) { return a[X] < b[X]; });
+        m_nodes.reserve(points.size());
+        buildTree(points.begin(), points.end());
+    }
+
+    size_t size() const { return m_nodes.size(); }
+
+    /// <summary>
+    /// Report all points inside the box [from, to]. Subtrees are pruned by from[Y] (Max) or to[Y] (!Max), hence the
+    /// query takes O(log n + k) time if the other side of the heap coordinate is unbounded.
+    /// Up to 'threads' threads are used (0 = hardware concurrency): the subtrees below the top levels are queried one
+    /// after another until the result has MinPointsPerThread points, the remaining ones in parallel.
+    /// </summary>
+    void query(const P &from, const P &to, std::vector<P> &result, unsigned threads = 1) const {
+        if (m_nodes.empty()) return;
+
+        const Box<T, 2> box(from, to);
+
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads == 1) {
+            query(0, box, result);
+        } else {
+            // about four subtrees per thread
+            std::vector<uint32_t> subtrees;
+            size_t i = 0;
+
+            queryTop(0, box, 4 * threads, result, subtrees);
+            for (; i < subtrees.size() && result.size() < MinPointsPerThread; i++) query(subtrees[i], box, result);
+            if (i < subtrees.size()) queryParallel(subtrees.begin() + i, subtrees.end(), box, threads, result);
+        }
+    }
+
+private:
+    // builds the subtree of the points in [beg, end), sorted by the search coordinate, and returns its root
+    uint32_t buildTree(const PIt &beg, const PIt &end) {
+        if (beg == end) return None;
+
+        // move the point with the highest priority to the front, keeping the order of the others
+        auto top = std::min_element(beg, end, [](const P &a, const P &b) { return precedes(a[Y], b[Y]); });
+        std::rotate(beg, top, top + 1);
+
+        const auto v = static_cast<uint32_t>(m_nodes.size());
+        const PIt m = beg + 1 + (end - beg) / 2;
+
+        m_nodes.push_back({*beg, (*(m - 1))[X], None, None});
+        if (m - beg > 1) m_nodes[v].left = buildTree(beg + 1, m);
+        m_nodes[v].right = buildTree(m, end);
+        return v;
+    }
+
+    void query(uint32_t v, const Box<T, 2> &box, std::vector<P> &result) const {
+        const Node &node = m_nodes[v];
+
+        // heap order: no point in this subtree satisfies the bound
+        if (precedes(Max ? box.lo[Y] : box.hi[Y], node.point[Y])) return;
+
+        if (box.contains(node.point)) result.push_back(node.point);
+        if (node.left != None && box.lo[X] <= node.split) query(node.left, box, result);
+        if (node.right != None && node.split <= box.hi[X]) query(node.right, box, result);
+    }
+
+    // queries the top levels of the subtree of v, with 'leaves' subtrees below them, and collects these subtrees
+    void queryTop(uint32_t v, const Box<T, 2> &box, size_t leaves, std::vector<P> &result,
+                  std::vector<uint32_t> &subtrees) const {
+        if (leaves <= 1) {
+            subtrees.push_back(v);
+            return;
+        }
+
+        const Node &node = m_nodes[v];
+
+        if (precedes(Max ? box.lo[Y] : box.hi[Y], node.point[Y])) return;
+
+        if (box.contains(node.point)) result.push_back(node.point);
+        if (node.left != None && box.lo[X] <= node.split) queryTop(node.left, box, leaves / 2, result, subtrees);
+        if (node.right != None && node.split <= box.hi[X]) queryTop(node.right, box, leaves / 2, result, subtrees);
+    }
+
+    // queries the subtrees [beg, end) with up to 'threads' threads, each into its own result
+    void queryParallel(std::vector<uint32_t>::const_iterator beg, std::vector<uint32_t>::const_iterator end,
+                       const Box<T, 2> &box, unsigned threads, std::vector<P> &result) const {
+        threads = static_cast<unsigned>(std::min<ptrdiff_t>(threads, end - beg));
+
+        std::vector<std::vector<P>> results(threads);
+        std::vector<std::thread> workers;
+        std::atomic<ptrdiff_t> next{0};
+
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                for (ptrdiff_t i = next++; i < end - beg; i = next++) query(beg[i], box, results[t]);
+            });
+        }
+        for (auto &worker: workers) worker.join();
+        for (const auto &r: results) result.insert(result.end(), r.begin(), r.end());
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Routes queries with an unbounded side to a priority search tree.
+// A bound is unbounded if it is the lowest or highest value of T (or an
+// infinity). The four trees are built from the points by build(), or else
+// each one the first time a query needs it, so that indexes without such
+// queries don't pay for them at startup.
+// Only 2-dim points are supported, for all other points query() never
+// handles a query.
+template<class P>
+class ThreeSidedQuery {
+public:
+    void build(const std::vector<P> &) {}
+
+    bool query(const P &, const P &, const std::vector<P> &, std::vector<P> &, unsigned) const { return false; }
+};
+
+template<typename T>
+class ThreeSidedQuery<Point<T, 2>> {
+    using P = Point<T, 2>;
+
+    // a priority search tree built by build() or by its first query
+    template<dim_t Y, bool Max>
+    class LazyTree {
+        using Tree = PrioritySearchTree<T, Y, Max>;
+
+        mutable std::unique_ptr<Tree> m_tree;
+        mutable std::once_flag m_built;
+
+    public:
+        void build(const std::vector<P> &points) const {
+            std::call_once(m_built, [&]() { m_tree = std::make_unique<Tree>(points); });
+        }
+
+        void query(const P &from, const P &to, const std::vector<P> &points, std::vector<P> &result,
+                   unsigned threads) const {
+            build(points);
+            m_tree->query(from, to, result, threads);
+        }
+    };
+
+    LazyTree<1, true> m_openTop;        // y unbounded above
+    LazyTree<1, false> m_openBottom;    // y unbounded below
+    LazyTree<0, true> m_openRight;      // x unbounded above
+    LazyTree<0, false> m_openLeft;      // x unbounded below
+
+    static bool isLowest(const T &v) {
+        return v == std::numeric_limits<T>::lowest() ||
+               (std::numeric_limits<T>::has_infinity && v == -std::numeric_limits<T>::infinity());
+    }
+
+    static bool isHighest(const T &v) {
+        return v == std::numeric_limits<T>::max() ||
+               (std::numeric_limits<T>::has_infinity && v == std::numeric_limits<T>::infinity());
+    }
+
+public:
+    /// <summary>
+    /// Build the trees which haven't been built yet, the points must be the same as in all queries.
+    /// </summary>
+    void build(const std::vector<P> &points) {
+        m_openTop.build(points);
+        m_openBottom.build(points);
+        m_openRight.build(points);
+        m_openLeft.build(points);
+    }
+
+    /// <summary>
+    /// Answer the query on the points with up to 'threads' threads if one of its sides is unbounded and return true,
+    /// otherwise return false. The points must be the same in all calls.
+    /// </summary>
+    bool query(const P &from, const P &to, const std::vector<P> &points, std::vector<P> &result,
+               unsigned threads) const {
+        if (isHighest(to[1])) {
+            m_openTop.query(from, to, points, result, threads);
+        } else if (isLowest(from[1])) {
+            m_openBottom.query(from, to, points, result, threads);
+        } else if (isHighest(to[0])) {
+            m_openRight.query(from, to, points, result, threads);
+        } else if (isLowest(from[0])) {
+            m_openLeft.query(from, to, points, result, threads);
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
@@ -2,26 +2,45 @@
 // Author: Yannick Huggler
 //
 
+#pragma once
+
+#include "PrioritySearchTree.hpp"
 #include "RangeTree.hpp"
 #include "Stopwatch.h"
 
-template<class P>
+template<class P, class E = ExactKey<typename P::ElementType>>
 class RangeQuery {
-    const std::vector<P> &m_points;
-    RangeTree<typename P::ElementType, P::Dimension> m_tree;
+    using T = typename P::ElementType;
+    using Tree = RangeTree<T, P::Dimension, P::Dimension, E>;
+
+    Tree m_tree;
+    ThreeSidedQuery<P> m_threeSided;
     Stopwatch stopwatch;
 
 public:
-    RangeQuery(const std::vector<P> &mPoints)
-            : m_points(mPoints),
-              m_tree(RangeTree<typename P::ElementType, P::Dimension>(mPoints)),
-              stopwatch(Stopwatch()) {}
+    /// <summary>
+    /// Build the range query of the points. The range query owns its points: pass an rvalue to move them in instead
+    /// of copying them. The tree sorts them by their first coordinate and keeps the only copy.
+    /// The priority search trees of queries with an unbounded side are built with the associated trees: here if mode
+    /// is Eager, otherwise by the first query which needs them.
+    /// </summary>
+    RangeQuery(std::vector<P> mPoints, size_t leafSize = DefaultLeafSize, AssocMode mode = AssocMode::Eager)
+            : m_tree(std::move(mPoints), leafSize, mode),
+              stopwatch(Stopwatch()) {
+        if (mode == AssocMode::Eager) m_threeSided.build(m_tree.points());
+    }
+
+    /// <summary>
+    /// Return the points, sorted by their first coordinate.
+    /// </summary>
+    const std::vector<P> &points() const { return m_tree.points(); }
 
     std::vector<P> trivial(const P &from, const P &to) const {
+        const Box<T, P::Dimension> box(from, to);
         std::vector<P> points{};
 
-        for (const auto item: m_points) {
-            if (item >= from && item <= to) {
+        for (const auto &item: m_tree.points()) {
+            if (box.contains(item)) {
                 points.push_back(item);
             }
         }
@@ -30,8 +49,63 @@ public:
         return points;
     }
 
-    std::vector<P> efficient(const P from, const P to) const {
-        return m_tree.query(from, to);
+    std::vector<P> efficient(const P from, const P to, unsigned threads = 0) const {
+        std::vector<P> points{};
+
+        if (m_threeSided.query(from, to, m_tree.points(), points, threads)) return points;
+        return m_tree.query(from, to, threads);
+    }
+
+    /// <summary>
+    /// Return k points chosen uniformly at random from the points inside [from, to], or all of them if there are at
+    /// most k. The same seed of rng gives the same sample.
+    /// </summary>
+    std::vector<P> sample(const P &from, const P &to, size_t k, std::mt19937_64 &rng) const {
+        return m_tree.sample(from, to, k, rng);
+    }
+
+    /// <summary>
+    /// Return the bitmap of the indices of all points inside [from, to], the indices refer to points().
+    /// </summary>
+    Bitmap efficientBitmap(const P &from, const P &to) const {
+        return m_tree.queryBitmap(from, to);
+    }
+
+    std::vector<P> trivialRadius(const P &center, const T &radius, Metric metric = Metric::L2) const {
+        std::vector<P> points{};
+
+        for (const auto item: m_tree.points()) {
+            double dist = 0;
+
+            for (dim_t i = 0; i < P::Dimension; i++) {
+                const double d = std::abs(static_cast<double>(item[i]) - static_cast<double>(center[i]));
+                dist = metric == Metric::L2 ? dist + d * d : std::max(dist, d);
+            }
+            if (dist <= (metric == Metric::L2 ? static_cast<double>(radius) * radius : static_cast<double>(radius))) {
+                points.push_back(item);
+            }
+        }
+
+        std::sort(points.begin(), points.end());
+        return points;
+    }
+
+    /// <summary>
+    /// Return all points within the distance 'radius' of 'center'. In the L2 metric the canonical subtrees are pruned
+    /// against the ball, in the L-infinity metric the ball is a box.
+    /// </summary>
+    std::vector<P> efficientRadius(const P &center, const T &radius, Metric metric = Metric::L2,
+                                   unsigned threads = 0) const {
+        if (metric == Metric::LInf) {
+            P from, to;
+
+            for (dim_t i = 0; i < P::Dimension; i++) {
+                from[i] = center[i] - radius;
+                to[i] = center[i] + radius;
+            }
+            return efficient(from, to, threads);
+        }
+        return m_tree.radiusQuery(center, radius, threads);
     }
 
     std::pair<double, double> performance(const P from, const P to) {
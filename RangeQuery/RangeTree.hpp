@@ -2,7 +2,15 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
 #include <vector>
+#include "Bitmap.h"
+#include "Box.h"
+#include "KeyEncoding.h"
 #include "Point.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -13,45 +21,353 @@
 // 
 
 ///////////////////////////////////////////////////////////////////////////////
-template<typename T, dim_t D> using SpVec = std::vector<std::shared_ptr<Point<T, D>>>;
-template<typename T, dim_t D> using SpIt = typename SpVec<T, D>::iterator;
+// Index of a point in the points of the tree, which are sorted by their first coordinate.
+using PointId = uint32_t;
 
+// Trees are built from references to the points. The leaves of the primary tree refer to ranges of the points of the
+// tree, the points are only copied into the leaves of associated trees.
 template<typename T, dim_t D>
-static void sortPoints(const SpIt<T, D> &beg, const SpIt<T, D> &end, dim_t coord) {
-    sort(beg, end, [coord](const std::shared_ptr<Point<T, D>> &a, const std::shared_ptr<Point<T, D>> &b) {
+struct PointRef {
+    const Point<T, D> *point;
+    PointId id;
+
+    const Point<T, D> &operator*() const { return *point; }
+};
+
+template<typename T, dim_t D> using RefVec = std::vector<PointRef<T, D>>;
+template<typename T, dim_t D> using RefIt = typename RefVec<T, D>::iterator;
+
+template<typename T, dim_t D>
+static void sortPoints(const RefIt<T, D> &beg, const RefIt<T, D> &end, dim_t coord) {
+    sort(beg, end, [coord](const PointRef<T, D> &a, const PointRef<T, D> &b) {
         return (*a)[coord] < (*b)[coord];
     });
 }
 
+// Default number of points per leaf bucket. Trees aren't subdivided and associated trees aren't built below this size.
+constexpr size_t DefaultLeafSize = 64;
+
+// Associated trees are either built with their tree or the first time a query reaches their node.
+enum class AssocMode { Eager, Lazy };
+
+// Minimal number of points copied per thread when the canonical subtrees of a query are reported in parallel.
+constexpr size_t MinPointsPerThread = 1 << 16;
+
+
+// Metrics of radius queries.
+enum class Metric { L2, LInf };
+
+// Position of a node's bounding box relative to a query region.
+enum class Overlap { Disjoint, Partial, Inside };
+
+///////////////////////////////////////////////////////////////////////////////
+// Query bounds: the closed query box in full precision and its encoded box,
+// whose closed key intervals are used to navigate the trees.
+// A query region provides the key intervals, contains(p), the overlap with the
+// encoded bounding box of a node and restrict(), which returns the region used
+// in the associated tree of a node.
+// With inexact encodings a key at the boundary of a key interval may belong to
+// points outside the box. Hence Inside requires the node's keys to lie strictly
+// inside, and precedingInside tells whether the points of the current tree are
+// known to lie inside the box in all preceding coordinates. Only then are the
+// points of a subtree reported without verifying them.
+template<typename T, dim_t D, typename E>
+struct QueryBounds {
+    using Key = typename E::Key;
+
+    // a box is the product of its coordinate ranges: the canonical subtrees of a tree with L = 1 are inside it
+    static constexpr bool separable = true;
+
+    Box<T, D> box;
+    Box<Key, D> keys;
+    bool precedingInside = true;
+
+    QueryBounds(const Point<T, D> &from, const Point<T, D> &to) : box(from, to), keys(encodeBox<E>(box)) {}
+
+    bool contains(const Point<T, D> &p) const { return box.contains(p); }
+
+    // overlap with the encoded box b in the last L coordinates
+    template<dim_t L>
+    Overlap overlap(const Box<Key, L> &b) const {
+        const Box<Key, L> last = keys.template last<L>();
+        const bool inside = E::exact ? last.containsBox(b) : last.containsInterior(b);
+
+        return !last.intersects(b) ? Overlap::Disjoint : inside ? Overlap::Inside : Overlap::Partial;
+    }
+
+    template<dim_t L>
+    QueryBounds restrict(const Box<Key, L> &b) const {
+        QueryBounds bounds(*this);
+
+        bounds.precedingInside = insideFirst(b);
+        return bounds;
+    }
+
+protected:
+    // true if the points of the current tree with keys in b lie inside the box in all coordinates up to D - L
+    template<dim_t L>
+    bool insideFirst(const Box<Key, L> &b) const {
+        return E::exact || (precedingInside & (keys.lo[D - L] < b.lo[0]) & (b.hi[0] < keys.hi[D - L]));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Ball bounds: all points p with |p - center| <= radius in the L2 metric.
+// The trees are navigated with the bounding box of the ball. The bounds
+// additionally bound the coordinates of the points in the current subtree
+// which precede the coordinates of its tree: restrict() narrows them to the
+// decoded bounding box of the node whose associated tree is queried.
+// Together with the decoded bounding boxes of the nodes this bounds all
+// coordinates, hence canonical subtrees are pruned or reported against the
+// ball itself.
+template<typename T, dim_t D, typename E>
+struct BallBounds : QueryBounds<T, D, E> {
+    using Dist = std::conditional_t<std::is_floating_point_v<T>, T, double>;
+    using Key = typename E::Key;
+
+    static constexpr bool separable = false;
+
+    Point<T, D> center;
+    Dist radius2;
+    Box<Dist, D> bounds;
+
+    BallBounds(const Point<T, D> &c, const T &radius)
+            : QueryBounds<T, D, E>(corner(c, radius, -1), corner(c, radius, +1)), center(c),
+              radius2(static_cast<Dist>(radius) * static_cast<Dist>(radius)) {
+        for (dim_t i = 0; i < D; i++) {
+            bounds.lo[i] = static_cast<Dist>(this->box.lo[i]);
+            bounds.hi[i] = static_cast<Dist>(this->box.hi[i]);
+        }
+    }
+
+    static Point<T, D> corner(const Point<T, D> &c, const T &radius, int sign) {
+        Point<T, D> p;
+
+        for (dim_t i = 0; i < D; i++) p[i] = c[i] + sign * radius;
+        return p;
+    }
+
+    bool contains(const Point<T, D> &p) const {
+        Dist dist = 0;
+
+        for (dim_t i = 0; i < D; i++) {
+            const Dist d = static_cast<Dist>(p[i]) - static_cast<Dist>(center[i]);
+            dist += d * d;
+        }
+        return dist <= radius2;
+    }
+
+    // overlap of the ball with the bounds in the first D - L and the decoded box b in the last L coordinates
+    template<dim_t L>
+    Overlap overlap(const Box<Key, L> &b) const {
+        Dist nearest = 0, farthest = 0;
+
+        for (dim_t i = 0; i < D; i++) {
+            const Dist c = static_cast<Dist>(center[i]);
+            const Dist l = i < D - L ? bounds.lo[i] : static_cast<Dist>(E::lower(b.lo[i - (D - L)]));
+            const Dist h = i < D - L ? bounds.hi[i] : static_cast<Dist>(E::upper(b.hi[i - (D - L)]));
+            const Dist near = std::max<Dist>(0, std::max(l - c, c - h));
+            const Dist far = std::max(c - l, h - c);
+
+            nearest += near * near;
+            farthest += far * far;
+        }
+        return nearest > radius2 ? Overlap::Disjoint : farthest <= radius2 ? Overlap::Inside : Overlap::Partial;
+    }
+
+    template<dim_t L>
+    BallBounds restrict(const Box<Key, L> &b) const {
+        BallBounds ball(*this);
+
+        for (dim_t i = 0; i < L; i++) {
+            ball.bounds.lo[D - L + i] = std::max(bounds.lo[D - L + i], static_cast<Dist>(E::lower(b.lo[i])));
+            ball.bounds.hi[D - L + i] = std::min(bounds.hi[D - L + i], static_cast<Dist>(E::upper(b.hi[i])));
+        }
+        ball.precedingInside = this->insideFirst(b);
+        return ball;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Query result: the points found by scanning leaves and the canonical subtrees
+// whose points are all inside the query box. The points of the subtrees are
+// copied in a second pass into a pre-sized vector. Large results are split
+// into equal ranges of the output, which are filled in parallel.
+template<typename T, dim_t D>
+class QueryResult {
+    using CopyFn = Point<T, D> *(*)(const void *node, size_t skip, size_t count, Point<T, D> *out);
+
+    struct Subtree {
+        const void *node;
+        size_t size;
+        CopyFn copy;        // copies 'count' points of the subtree, starting with its 'skip'-th point
+    };
+
+    std::vector<Point<T, D>> m_points;
+    std::vector<Subtree> m_subtrees;
+    std::vector<size_t> m_offsets;      // position of the first point of each subtree
+    size_t m_subtreePoints = 0;
+
+public:
+    std::vector<Point<T, D>> &points() { return m_points; }
+
+    void addSubtree(const void *node, size_t size, CopyFn copy) {
+        m_subtrees.push_back({node, size, copy});
+        m_offsets.push_back(m_subtreePoints);
+        m_subtreePoints += size;
+    }
+
+    size_t size() const { return m_points.size() + m_subtreePoints; }
+
+    /// <summary>
+    /// Return all points of the result, using up to 'threads' threads (0 = hardware concurrency).
+    /// </summary>
+    std::vector<Point<T, D>> collect(unsigned threads) {
+        const size_t offset = m_points.size();
+        std::vector<Point<T, D>> result = std::move(m_points);
+
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, m_subtreePoints / MinPointsPerThread)));
+
+        result.resize(offset + m_subtreePoints);
+
+        if (threads == 1) {
+            copy(0, m_subtreePoints, result.data() + offset);
+        } else {
+            std::vector<std::thread> workers;
+            const size_t chunk = (m_subtreePoints + threads - 1) / threads;
+
+            for (size_t beg = 0; beg < m_subtreePoints; beg += chunk) {
+                const size_t end = std::min(beg + chunk, m_subtreePoints);
+                workers.emplace_back([this, beg, end, out = result.data() + offset + beg]() { copy(beg, end, out); });
+            }
+            for (auto &worker: workers) worker.join();
+        }
+        return result;
+    }
+
+    /// <summary>
+    /// Return k points of the result chosen uniformly at random without replacement, or all points if there are at
+    /// most k. Only the k chosen points are copied.
+    /// </summary>
+    std::vector<Point<T, D>> sample(size_t k, std::mt19937_64 &rng) const {
+        const size_t n = size();
+        std::vector<Point<T, D>> result;
+
+        if (k >= n) {
+            result = m_points;
+            result.resize(n);
+            copy(0, m_subtreePoints, result.data() + m_points.size());
+            return result;
+        }
+
+        // Floyd's algorithm: k distinct ranks in [0, n)
+        std::unordered_set<size_t> ranks;
+
+        for (size_t j = n - k; j < n; j++) {
+            const size_t t = std::uniform_int_distribution<size_t>(0, j)(rng);
+
+            ranks.insert(ranks.count(t) ? j : t);
+        }
+
+        // rank i is the i-th scanned point, followed by the points of the subtrees in order
+        result.resize(k);
+        auto out = result.begin();
+        for (size_t rank: ranks) {
+            if (rank < m_points.size()) {
+                *out++ = m_points[rank];
+            } else {
+                const size_t i = rank - m_points.size();
+
+                copy(i, i + 1, &*out++);
+            }
+        }
+        return result;
+    }
+
+private:
+    // copies the points [beg, end) of the concatenated subtrees to out
+    void copy(size_t beg, size_t end, Point<T, D> *out) const {
+        // the first subtree is the last one starting at or before beg
+        size_t i = std::upper_bound(m_offsets.begin(), m_offsets.end(), beg) - m_offsets.begin();
+        i = i > 0 ? i - 1 : 0;
+
+        for (; i < m_subtrees.size() && m_offsets[i] < end; i++) {
+            const Subtree &subtree = m_subtrees[i];
+            const size_t skip = beg > m_offsets[i] ? beg - m_offsets[i] : 0;
+            const size_t count = std::min(end, m_offsets[i] + subtree.size) - m_offsets[i] - skip;
+
+            out = subtree.copy(subtree.node, skip, count, out);
+        }
+    }
+};
+
 
-template<typename T, dim_t L>
+template<typename T, dim_t L, typename E = ExactKey<T>>
 class Node {
-    using AssocUP = std::unique_ptr<Node<T, L - 1>>;
-    using AssocPtr = Node<T, L - 1> *;
+    using AssocUP = std::unique_ptr<Node<T, L - 1, E>>;
+    using AssocPtr = Node<T, L - 1, E> *;
 
-    AssocUP m_assoc;
+    mutable AssocUP m_assoc;
+    mutable std::once_flag m_assocBuilt;
+    uint32_t m_lazyLeafSize;    // leaf size of the associated tree if it is built on first use, otherwise 0
 
 public:
-    explicit Node(AssocUP&& assoc) : m_assoc(std::move(assoc)) {}
+    using Key = typename E::Key;
+
+    // leaves have no associated tree
+    Node() : m_lazyLeafSize(0) {}
+
+    explicit Node(AssocUP&& assoc, size_t lazyLeafSize = 0)
+            : m_assoc(std::move(assoc)), m_lazyLeafSize(static_cast<uint32_t>(lazyLeafSize)) {}
 
     virtual ~Node() = default;
 
-    Node<T, L - 1> *assoc() const {
+    /// <summary>
+    /// Return the associated tree, or nullptr if it is built lazily and hasn't been built yet.
+    /// </summary>
+    Node<T, L - 1, E> *assoc() const {
         return m_assoc.get();
     }
 
-    virtual const T &key() const = 0;
+    /// <summary>
+    /// Return the associated tree. A lazily built tree is built by build(leafSize) on first use, exactly once even if
+    /// several threads reach the node at the same time.
+    /// </summary>
+    template<class Build>
+    Node<T, L - 1, E> *assoc(Build &&build) const {
+        if (m_lazyLeafSize) std::call_once(m_assocBuilt, [&]() { m_assoc = build(m_lazyLeafSize); });
+        return m_assoc.get();
+    }
+
+    virtual Key key() const = 0;
+
+    virtual size_t size() const = 0;
+
+    // smallest and largest index of the points in the subtree
+    virtual PointId minId() const = 0;
+
+    virtual PointId maxId() const = 0;
 
     virtual void print(std::ostream &os) const = 0;
 };
 
-template<typename T>
-class Node<T, 1> {
+template<typename T, typename E>
+class Node<T, 1, E> {
 
 public:
+    using Key = typename E::Key;
+
     virtual ~Node() = default;
 
-    virtual const T &key() const = 0;
+    virtual Key key() const = 0;
+
+    virtual size_t size() const = 0;
+
+    // smallest and largest index of the points in the subtree
+    virtual PointId minId() const = 0;
+
+    virtual PointId maxId() const = 0;
 
     virtual void print(std::ostream &os) const = 0;
 };
@@ -74,113 +390,247 @@ public:
 // general classes
 
 ///////////////////////////////////////////////////////////////////////////////
-template<typename T, dim_t L>
-class InnerNode : public Node<T, L> {
-    using AssocUP = std::unique_ptr<Node<T, L - 1>>;
-    using NodeUP = std::unique_ptr<Node<T, L>>;
-    using NodePtr = const Node<T, L> *;
+// An inner node of a tree with L > 1 also stores the encoded bounding box of its points in the last L coordinates.
+// The split key and the box are stored as one block of keys, and the counts take 4 bytes each, so that nodes
+// shrink with the size of the keys: 112, 80 and 72 bytes for 3-dim double, float and bfloat16 keys.
+template<typename T, dim_t L, typename E = ExactKey<T>>
+class InnerNode : public Node<T, L, E> {
+    using AssocUP = std::unique_ptr<Node<T, L - 1, E>>;
+    using NodeUP = std::unique_ptr<Node<T, L, E>>;
+    using NodePtr = const Node<T, L, E> *;
+    using Key = typename E::Key;
 
     NodeUP m_left, m_right;
-    T m_key;
+    uint32_t m_size;
+    PointId m_minId, m_maxId;
+    Key m_key;
+    Box<Key, L> m_box;
 
 public:
-    InnerNode(const T &key, NodeUP &&left, NodeUP &&right, AssocUP &&assoc)
-            : Node<T, L>(std::move(assoc)), m_left(std::move(left)), m_right(std::move(right)), m_key(key) {}
+    InnerNode(const Key &key, const Box<Key, L> &box, NodeUP &&left, NodeUP &&right, AssocUP &&assoc,
+              size_t lazyLeafSize = 0)
+            : Node<T, L, E>(std::move(assoc), lazyLeafSize), m_left(std::move(left)), m_right(std::move(right)),
+              m_size(static_cast<uint32_t>(m_left->size() + m_right->size())),
+              m_minId(std::min(m_left->minId(), m_right->minId())), m_maxId(std::max(m_left->maxId(), m_right->maxId())),
+              m_key(key), m_box(box) {}
 
     NodePtr left() const { return m_left.get(); }
 
     NodePtr right() const { return m_right.get(); }
 
-    const T &key() const override { return m_key; }
+    const Box<Key, L> &box() const { return m_box; }
+
+    Key key() const override { return m_key; }
+
+    size_t size() const override { return m_size; }
+
+    PointId minId() const override { return m_minId; }
+
+    PointId maxId() const override { return m_maxId; }
 
     void print(std::ostream &os) const override {
         m_left->print(os);
         os << ",{";
-        this->assoc()->print(os);
+        if (this->assoc()) this->assoc()->print(os);
         os << "},";
         m_right->print(os);
     }
 };
 
 ///////////////////////////////////////////////////////////////////////////////
-template<typename T, dim_t L, dim_t D>
-class LeafNode : public Node<T, L> {
-    using AssocUP = std::unique_ptr<Node<T, L - 1>>;
+// The points of a leaf: copies of the points and their indices, or a range of the points of the tree, whose indices
+// are contiguous.
+template<typename T, dim_t D, bool Copied>
+class LeafPoints {
+    std::vector<Point<T, D>> m_points;
+    std::vector<PointId> m_ids;     // indices of the points
+
+public:
+    LeafPoints(const RefIt<T, D> &beg, const RefIt<T, D> &end) {
+        m_points.reserve(end - beg);
+        m_ids.reserve(end - beg);
+        for (auto it = beg; it != end; ++it) {
+            m_points.push_back(**it);
+            m_ids.push_back(it->id);
+        }
+    }
+
+    const Point<T, D> *data() const { return m_points.data(); }
 
-    std::shared_ptr<Point<T, D>> m_point;
+    size_t size() const { return m_points.size(); }
+
+    PointId id(size_t i) const { return m_ids[i]; }
+};
+
+template<typename T, dim_t D>
+class LeafPoints<T, D, false> {
+    const Point<T, D> *m_points;
+    PointId m_first, m_size;
 
 public:
-    LeafNode(const std::shared_ptr<Point<T, D>> &point, AssocUP &&assoc)
-            : Node<T, L>(std::move(assoc)), m_point(point) {}
+    LeafPoints(const RefIt<T, D> &beg, const RefIt<T, D> &end)
+            : m_points(beg->point), m_first(beg->id), m_size(static_cast<PointId>(end - beg)) {}
 
-    Point<T, D> get() const { return *m_point; }
+    const Point<T, D> *data() const { return m_points; }
 
-    const T &key() const override { return (*m_point)[D - L]; }
+    size_t size() const { return m_size; }
 
-    void print(std::ostream &os) const override { os << *m_point; }
+    PointId id(size_t i) const { return m_first + static_cast<PointId>(i); }
 };
 
 ///////////////////////////////////////////////////////////////////////////////
-template<typename T, dim_t L, dim_t D = L>
-class RangeTree {
-    using AssocUP = std::unique_ptr<Node<T, L - 1>>;
-    using NodeUP = std::unique_ptr<Node<T, L>>;
-    using NodePtr = const Node<T, L> *;
-    using LeafPtr = const LeafNode<T, L, D> *;
-    using InnerPtr = const InnerNode<T, L> *;
+// A leaf holds a bucket of points, sorted by the (1 + D - L)-th coordinates. Leaves have no associated trees,
+// instead the bucket is scanned for points inside the query box. The same class serves all levels, including L = 1.
+// The leaves of the primary tree (L = D) refer to a range of the points of the tree, all other leaves hold copies.
+template<typename T, dim_t L, dim_t D, typename E = ExactKey<T>>
+class LeafNode : public Node<T, L, E> {
+    using Key = typename E::Key;
 
-    NodeUP m_root;
-    size_t m_size;
+    LeafPoints<T, D, (L < D)> m_points;
+    PointId m_minId, m_maxId;
 
 public:
-    RangeTree(std::vector<Point<T, D>> points) : m_size(points.size()) {
-        SpVec<T, D> spoints(m_size);
-        auto it = spoints.begin();
+    LeafNode(const RefIt<T, D> &beg, const RefIt<T, D> &end) : m_points(beg, end) {
+        m_minId = m_maxId = m_points.id(0);
+        for (size_t i = 1; i < m_points.size(); i++) {
+            m_minId = std::min(m_minId, m_points.id(i));
+            m_maxId = std::max(m_maxId, m_points.id(i));
+        }
+    }
+
+    const Point<T, D> *points() const { return m_points.data(); }
+
+    PointId id(size_t i) const { return m_points.id(i); }
 
-        for (const Point<T, D> &p: points) *it++ = std::make_shared<Point<T, D>>(p);
-        ::sortPoints<T, D>(spoints.begin(), it, D - L);
-        m_root = buildTree(spoints.begin(), it);
+    Key key() const override { return E::encode(points()[size() - 1][D - L]); }
+
+    size_t size() const override { return m_points.size(); }
+
+    PointId minId() const override { return m_minId; }
+
+    PointId maxId() const override { return m_maxId; }
+
+    template<class Region>
+    void report(const Region &region, QueryResult<T, D> &result) const {
+        const Point<T, D> *p = points();
+
+        for (size_t i = 0; i < size(); i++) {
+            if (region.contains(p[i])) result.points().push_back(p[i]);
+        }
     }
 
-    static NodeUP buildTree(const SpIt<T, D> &beg, const SpIt<T, D> &end) {
-        if (end - beg == 1) {
-            return std::make_unique<LeafNode<T, L, D>>(*beg, std::move(RangeTree<T, L - 1, D>::buildTree(beg, end)));
-        } else {
-            SpIt<T, D> m = beg + (end - beg) / 2;
-            const T key = (**(m - 1))[D -
-                                      L];    // must be called before buildAssocTree, because it changes order of points
-            auto left = buildTree(beg,
-                                  m);        // must be called before buildAssocTree, because it changes order of points
-            auto right = buildTree(m,
-                                   end);        // must be called before buildAssocTree, because it changes order of points
-            return std::make_unique<InnerNode<T, L>>(key, std::move(left), std::move(right), buildAssocTree(beg, end));
+    template<class Region>
+    void report(const Region &region, Bitmap &result) const {
+        const Point<T, D> *p = points();
+
+        for (size_t i = 0; i < size(); i++) result.set(id(i), region.contains(p[i]));
+    }
+
+    void print(std::ostream &os) const override {
+        std::string separator;
+        for (size_t i = 0; i < size(); i++) {
+            os << separator << points()[i];
+            separator = ",";
         }
     }
+};
 
-    static AssocUP buildAssocTree(const SpIt<T, D> &beg, const SpIt<T, D> &end) {
-        ::sortPoints<T, D>(beg, end, D - L + 1);
-        return RangeTree<T, L - 1, D>::buildTree(beg, end);
+template<typename T, dim_t L, dim_t D = L, typename E = ExactKey<T>>
+class RangeTree;
+
+///////////////////////////////////////////////////////////////////////////////
+// Queries shared by the trees of all levels, including L = 1. The tree of a
+// level builds its nodes with buildTree() and reports the canonical subtrees
+// next to the search paths with reportCanonical().
+template<typename T, dim_t L, dim_t D, typename E>
+class RangeTreeBase {
+    using NodeUP = std::unique_ptr<Node<T, L, E>>;
+    using NodePtr = const Node<T, L, E> *;
+    using LeafPtr = const LeafNode<T, L, D, E> *;
+    using InnerPtr = const InnerNode<T, L, E> *;
+    using Key = typename E::Key;
+    using Bounds = QueryBounds<T, D, E>;
+    using Tree = RangeTree<T, L, D, E>;
+
+    std::vector<Point<T, D>> m_points;
+    NodeUP m_root;
+
+public:
+    /// <summary>
+    /// Build the tree of the points. The tree owns its points and sorts them by their first coordinate: pass an rvalue
+    /// to move them in instead of copying them. A tree without points has no root and answers all queries empty.
+    /// </summary>
+    RangeTreeBase(std::vector<Point<T, D>> points, size_t leafSize = DefaultLeafSize, AssocMode mode = AssocMode::Eager)
+            : m_points(std::move(points)) {
+        RefVec<T, D> refs(m_points.size());
+
+        std::sort(m_points.begin(), m_points.end(), [](const Point<T, D> &a, const Point<T, D> &b) {
+            return a[D - L] < b[D - L];
+        });
+        for (size_t i = 0; i < refs.size(); i++) refs[i] = {&m_points[i], PointId(i)};
+        if (!refs.empty()) m_root = Tree::buildTree(refs.begin(), refs.end(), std::max<size_t>(leafSize, 1), mode);
     }
 
-    std::vector<Point<T, D>> query(const Point<T, D> &from, const Point<T, D> &to) const {
-        std::vector<Point<T, D>> result;
+    /// <summary>
+    /// Return the points of the tree, sorted by their first coordinate. Bitmaps refer to their indices.
+    /// </summary>
+    const std::vector<Point<T, D>> &points() const { return m_points; }
 
-        query(m_root.get(), from, to.nextAfter(), result);
+    /// <summary>
+    /// Return all points inside the closed box [from, to], copied by up to 'threads' threads (0 = hardware concurrency).
+    /// </summary>
+    std::vector<Point<T, D>> query(const Point<T, D> &from, const Point<T, D> &to, unsigned threads = 0) const {
+        QueryResult<T, D> result;
+
+        if (m_root) query(m_root.get(), Bounds(from, to), result);
+        return result.collect(threads);
+    }
+
+    /// <summary>
+    /// Return k points chosen uniformly at random from the points inside the closed box [from, to]. The canonical
+    /// subtrees are only counted, the chosen points are selected in them by the sizes of their subtrees.
+    /// With inexact encodings the points of subtrees whose keys touch a boundary key of the query are verified,
+    /// which adds the number of points sharing the boundary keys to the time.
+    /// </summary>
+    std::vector<Point<T, D>> sample(const Point<T, D> &from, const Point<T, D> &to, size_t k,
+                                    std::mt19937_64 &rng) const {
+        QueryResult<T, D> result;
+
+        if (m_root) query(m_root.get(), Bounds(from, to), result);
+        return result.sample(k, rng);
+    }
+
+    /// <summary>
+    /// Return the bitmap of the indices of all points inside the closed box [from, to].
+    /// </summary>
+    Bitmap queryBitmap(const Point<T, D> &from, const Point<T, D> &to) const {
+        Bitmap result(m_points.size());
+
+        if (m_root) query(m_root.get(), Bounds(from, to), result);
         return result;
     }
 
-    static void query(NodePtr v, const Point<T, D> &from, const Point<T, D> &to, std::vector<Point<T, D>> &result) {
-        const T &fromKey = from[D - L];
-        const T &toKey = to[D - L];
+    /// <summary>
+    /// Return all points within the L2 distance 'radius' of 'center', copied by up to 'threads' threads.
+    /// </summary>
+    std::vector<Point<T, D>> radiusQuery(const Point<T, D> &center, const T &radius, unsigned threads = 0) const {
+        QueryResult<T, D> result;
+
+        if (m_root) query(m_root.get(), BallBounds<T, D, E>(center, radius), result);
+        return result.collect(threads);
+    }
+
+    template<class Region, class Result>
+    static void query(NodePtr v, const Region &region, Result &result) {
+        const Key &fromKey = region.keys.lo[D - L];
+        const Key &toKey = region.keys.hi[D - L];
 
         v = findSplitNode(v, fromKey, toKey);
         auto lv = dynamic_cast<LeafPtr>(v);
 
         if (lv) {
             // v is a leaf
-            if (fromKey <= lv->key() && lv->key() < toKey) {
-                RangeTree<T, L - 1, D>::query(lv->assoc(), from, to, result);
-            }
+            lv->report(region, result);
 
         } else {
             // vsplit is an innerNode
@@ -194,16 +644,14 @@ public:
                 auto iv = static_cast<InnerPtr>(v);
 
                 if (fromKey <= iv->key()) {
-                    RangeTree<T, L - 1, D>::query(iv->right()->assoc(), from, to, result);
+                    Tree::reportCanonical(iv->right(), region, result);
                     v = iv->left();
                 } else {
                     v = iv->right();
                 }
                 lv = dynamic_cast<LeafPtr>(v);
             }
-            if (fromKey <= lv->key() && lv->key() < toKey) {
-                RangeTree<T, L - 1, D>::query(lv->assoc(), from, to, result);
-            }
+            lv->report(region, result);
 
             // follow the path to 'to' and report the points in subtrees left of the path
             v = ivs->right();
@@ -212,34 +660,32 @@ public:
             while (!lv) {
                 auto iv = static_cast<InnerPtr>(v);
 
-                if (iv->key() < toKey) {
-                    RangeTree<T, L - 1, D>::query(iv->left()->assoc(), from, to, result);
+                if (iv->key() <= toKey) {
+                    Tree::reportCanonical(iv->left(), region, result);
                     v = iv->right();
                 } else {
                     v = iv->left();
                 }
                 lv = dynamic_cast<LeafPtr>(v);
             }
-            if (fromKey <= lv->key() && lv->key() < toKey) {
-                RangeTree<T, L - 1, D>::query(lv->assoc(), from, to, result);
-            }
+            lv->report(region, result);
         }
     }
 
-    friend std::ostream &operator<<(std::ostream &os, const RangeTree<T, L, D> &rt) {
+    friend std::ostream &operator<<(std::ostream &os, const RangeTreeBase &rt) {
         os << '[';
-        rt.m_root->print(os);
+        if (rt.m_root) rt.m_root->print(os);
         return os << ']';
     }
 
 private:
-    static NodePtr findSplitNode(NodePtr v, const T &from, const T &to) {
-        auto *lv = dynamic_cast<LeafPtr>(v);
+    static NodePtr findSplitNode(NodePtr v, const Key &from, const Key &to) {
+        auto lv = dynamic_cast<LeafPtr>(v);
 
-        while (!lv && (to <= v->key() || v->key() < from)) {
-            auto *iv = static_cast<InnerPtr>(v);
+        while (!lv && (to < v->key() || v->key() < from)) {
+            auto iv = static_cast<InnerPtr>(v);
 
-            if (to <= v->key()) {
+            if (to < v->key()) {
                 v = iv->left();
             } else {
                 v = iv->right();
@@ -248,184 +694,310 @@ private:
         }
         return v;
     }
-};
 
+protected:
+    template<class Region, class Result>
+    static void reportVerified(NodePtr v, const Region &region, Result &result) {
+        auto lv = dynamic_cast<LeafPtr>(v);
 
-///////////////////////////////////////////////////////////////////////////////
-// specialization
-///////////////////////////////////////////////////////////////////////////////
+        if (lv) {
+            // v is a leaf
+            lv->report(region, result);
+        } else {
+            // v is an innerNode
+            auto iv = static_cast<InnerPtr>(v);
 
-///////////////////////////////////////////////////////////////////////////////
-template<typename T>
-class InnerNode<T, 1> : public Node<T, 1> {
-    using NodeUP = std::unique_ptr<Node<T, 1>>;
-    using NodePtr = const Node<T, 1> *;
+            reportVerified(iv->left(), region, result);
+            reportVerified(iv->right(), region, result);
+        }
+    }
 
-    NodeUP m_left, m_right;
-    T m_key;
+    // all points of v are inside the query region
+    static void addSubtree(NodePtr v, QueryResult<T, D> &result) {
+        result.addSubtree(v, v->size(), &copySubtree);
+    }
 
-public:
-    InnerNode(const T &key, NodeUP &&left, NodeUP &&right)
-            : m_left(std::move(left)), m_right(std::move(right)), m_key(key) {}
+    static void addSubtree(NodePtr v, Bitmap &result) {
+        if (v->maxId() - v->minId() + 1 == v->size()) {
+            // the indices of v are contiguous
+            result.setRange(v->minId(), v->maxId() + 1);
+        } else if (auto lv = dynamic_cast<LeafPtr>(v)) {
+            for (size_t i = 0; i < lv->size(); i++) result.set(lv->id(i));
+        } else {
+            auto iv = static_cast<InnerPtr>(v);
 
-    NodePtr left() const { return m_left.get(); }
+            addSubtree(iv->left(), result);
+            addSubtree(iv->right(), result);
+        }
+    }
 
-    NodePtr right() const { return m_right.get(); }
+    // copies 'count' points of the subtree v to out, starting with its 'skip'-th point, and returns the end of out
+    static Point<T, D> *copySubtree(const void *node, size_t skip, size_t count, Point<T, D> *out) {
+        auto v = static_cast<NodePtr>(node);
+        auto lv = dynamic_cast<LeafPtr>(v);
 
-    const T &key() const override { return m_key; }
+        if (lv) {
+            // v is a leaf
+            return std::copy_n(lv->points() + skip, count, out);
+        } else {
+            // v is an innerNode: skip complete subtrees by their sizes
+            auto iv = static_cast<InnerPtr>(v);
+            const size_t leftSize = iv->left()->size();
 
-    void print(std::ostream &os) const override {
-        m_left->print(os);
-        os << ',';
-        m_right->print(os);
+            if (skip < leftSize) {
+                const size_t n = std::min(count, leftSize - skip);
+
+                out = copySubtree(iv->left(), skip, n, out);
+                count -= n;
+                skip = 0;
+            } else {
+                skip -= leftSize;
+            }
+            return count > 0 ? copySubtree(iv->right(), skip, count, out) : out;
+        }
     }
 };
 
 ///////////////////////////////////////////////////////////////////////////////
-template<typename T, dim_t D>
-class LeafNode<T, 1, D> : public Node<T, 1> {
-    std::shared_ptr<Point<T, D>> m_point;
+template<typename T, dim_t L, dim_t D, typename E>
+class RangeTree : public RangeTreeBase<T, L, D, E> {
+    using Base = RangeTreeBase<T, L, D, E>;
+    using AssocUP = std::unique_ptr<Node<T, L - 1, E>>;
+    using NodeUP = std::unique_ptr<Node<T, L, E>>;
+    using NodePtr = const Node<T, L, E> *;
+    using LeafPtr = const LeafNode<T, L, D, E> *;
+    using InnerPtr = const InnerNode<T, L, E> *;
+    using Key = typename E::Key;
+
+    friend Base;
 
 public:
-    LeafNode(const std::shared_ptr<Point<T, D>> &point) : m_point(point) {}
-
-    Point<T, D> get() const { return *m_point; }
+    using Base::Base;
 
-    const T &key() const override { return (*m_point)[D - 1]; }
-
-    void print(std::ostream &os) const override { os << *m_point; }
-};
-
-///////////////////////////////////////////////////////////////////////////////
-template<typename T, dim_t D>
-class RangeTree<T, 1, D> {
-    using NodeUP = std::unique_ptr<Node<T, 1>>;
-    using NodePtr = const Node<T, 1> *;
-    using LeafPtr = const LeafNode<T, 1, D> *;
-    using InnerPtr = const InnerNode<T, 1> *;
+    static NodeUP buildTree(const RefIt<T, D> &beg, const RefIt<T, D> &end, size_t leafSize, AssocMode mode) {
+        if (static_cast<size_t>(end - beg) <= leafSize) {
+            return std::make_unique<LeafNode<T, L, D, E>>(beg, end);
+        } else {
+            RefIt<T, D> m = beg + (end - beg) / 2;
+            const Key key = E::encode((**(m - 1))[D - L]);    // must be called before buildAssocTree, because it changes order of points
+            auto left = buildTree(beg, m, leafSize,
+                                  mode);            // must be called before buildAssocTree, because it changes order of points
+            auto right = buildTree(m, end, leafSize,
+                                   mode);           // must be called before buildAssocTree, because it changes order of points
+            const Box<Key, L> box = encodeBox<E>(boundingBox(beg, end));
+
+            if (mode == AssocMode::Lazy) {
+                return std::make_unique<InnerNode<T, L, E>>(key, box, std::move(left), std::move(right), nullptr,
+                                                            leafSize);
+            }
+            return std::make_unique<InnerNode<T, L, E>>(key, box, std::move(left), std::move(right),
+                                                        buildAssocTree(beg, end, leafSize, mode));
+        }
+    }
 
-    NodeUP m_root;
-    size_t m_size;
+    static Box<T, L> boundingBox(const RefIt<T, D> &beg, const RefIt<T, D> &end) {
+        Box<T, L> box;
 
-public:
-    RangeTree(std::vector<Point<T, D>> points) : m_size(points.size()) {
-        SpVec<T, D> spoints(m_size);
-        auto it = spoints.begin();
+        for (dim_t i = 0; i < L; i++) box.lo[i] = box.hi[i] = (**beg)[D - L + i];
+        for (auto it = beg; it != end; ++it) {
+            for (dim_t i = 0; i < L; i++) {
+                box.lo[i] = std::min(box.lo[i], (**it)[D - L + i]);
+                box.hi[i] = std::max(box.hi[i], (**it)[D - L + i]);
+            }
+        }
+        return box;
+    }
 
-        for (const Point<T, D> &p: points) *it++ = std::make_shared<Point<T, D>>(p);
-        ::sortPoints<T, D>(spoints.begin(), it, D - 1);
-        m_root = buildTree(spoints.begin(), it);
+    static AssocUP buildAssocTree(const RefIt<T, D> &beg, const RefIt<T, D> &end, size_t leafSize, AssocMode mode) {
+        ::sortPoints<T, D>(beg, end, D - L + 1);
+        return RangeTree<T, L - 1, D, E>::buildTree(beg, end, leafSize, mode);
     }
 
-    static NodeUP buildTree(const SpIt<T, D> &beg, const SpIt<T, D> &end) {
-        if (end - beg == 1) {
-            return std::make_unique<LeafNode<T, 1, D>>(*beg);
+private:
+    using Base::addSubtree;
+    using Base::reportVerified;
+
+    // v is inside the query range in this coordinate: leaves are scanned, inner nodes whose bounding box lies inside
+    // the query region are reported completely, inner nodes whose bounding box misses the query region are skipped,
+    // and all other inner nodes query their associated tree
+    template<class Region, class Result>
+    static void reportCanonical(NodePtr v, const Region &region, Result &result) {
+        auto lv = dynamic_cast<LeafPtr>(v);
+
+        if (lv) {
+            lv->report(region, result);
         } else {
-            SpIt<T, D> m = beg + (end - beg) / 2;
-            return std::make_unique<InnerNode<T, 1>>((**(m - 1))[D - 1], buildTree(beg, m), buildTree(m, end));
+            auto iv = static_cast<InnerPtr>(v);
+            const Overlap overlap = region.overlap(iv->box());
+
+            if (overlap == Overlap::Inside) {
+                reportSubtree(iv, region, result);
+            } else if (overlap == Overlap::Partial) {
+                RangeTree<T, L - 1, D, E>::query(assocTree(iv), region.restrict(iv->box()), result);
+            }
         }
     }
 
-    std::vector<Point<T, D>> query(const Point<T, D> &from, const Point<T, D> &to) const {
-        std::vector<Point<T, D>> result;
+    // returns the associated tree of v, lazily built trees are built from the points in the leaves of v
+    static const Node<T, L - 1, E> *assocTree(InnerPtr v) {
+        return v->assoc([v](size_t leafSize) {
+            RefVec<T, D> points;
 
-        query(m_root.get(), from, to.nextAfter(), result);
-        return result;
+            points.reserve(v->size());
+            gatherPoints(v, points);
+            return buildAssocTree(points.begin(), points.end(), leafSize, AssocMode::Lazy);
+        });
     }
 
-    static void query(NodePtr v, const Point<T, D> &from, const Point<T, D> &to, std::vector<Point<T, D>> &result) {
-        const T &fromKey = from[D - 1];
-        const T &toKey = to[D - 1];
-
-        v = findSplitNode(v, fromKey, toKey);
+    static void gatherPoints(NodePtr v, RefVec<T, D> &points) {
         auto lv = dynamic_cast<LeafPtr>(v);
 
         if (lv) {
-            // v is a leaf
-            if (fromKey <= lv->key() && lv->key() < toKey) {
-                result.push_back(lv->get());
-            }
+            for (size_t i = 0; i < lv->size(); i++) points.push_back({&lv->points()[i], lv->id(i)});
+        } else {
+            auto iv = static_cast<InnerPtr>(v);
+
+            gatherPoints(iv->left(), points);
+            gatherPoints(iv->right(), points);
+        }
+    }
 
+    template<class Region, class Result>
+    static void reportSubtree(NodePtr v, const Region &region, Result &result) {
+        if (region.precedingInside) {
+            // all points of v are inside the query region, they are copied when the result is collected
+            addSubtree(v, result);
         } else {
-            // vsplit is an innerNode
-            auto ivs = static_cast<InnerPtr>(v);
+            // with inexact encodings the points may lie outside the query region in preceding coordinates
+            reportVerified(v, region, result);
+        }
+    }
+};
 
-            // follow the path to 'from' and report the points in subtrees right of the path
-            v = ivs->left();
-            lv = dynamic_cast<LeafPtr>(v);
 
-            while (!lv) {
-                auto iv = static_cast<InnerPtr>(v);
+///////////////////////////////////////////////////////////////////////////////
+// specialization
+///////////////////////////////////////////////////////////////////////////////
 
-                if (fromKey <= iv->key()) {
-                    reportSubtree(iv->right(), result);
-                    v = iv->left();
-                } else {
-                    v = iv->right();
-                }
-                lv = dynamic_cast<LeafPtr>(v);
-            }
-            if (fromKey <= lv->key() && lv->key() < toKey) {
-                result.push_back(lv->get());
-            }
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, typename E>
+class InnerNode<T, 1, E> : public Node<T, 1, E> {
+    using NodeUP = std::unique_ptr<Node<T, 1, E>>;
+    using NodePtr = const Node<T, 1, E> *;
+    using Key = typename E::Key;
 
-            // follow the path to 'to' and report the points in subtrees left of the path
-            v = ivs->right();
-            lv = dynamic_cast<LeafPtr>(v);
+    NodeUP m_left, m_right;
+    uint32_t m_size;
+    PointId m_minId, m_maxId;
+    Key m_key;
 
-            while (!lv) {
-                auto iv = static_cast<InnerPtr>(v);
+public:
+    InnerNode(const Key &key, NodeUP &&left, NodeUP &&right)
+            : m_left(std::move(left)), m_right(std::move(right)),
+              m_size(static_cast<uint32_t>(m_left->size() + m_right->size())),
+              m_minId(std::min(m_left->minId(), m_right->minId())), m_maxId(std::max(m_left->maxId(), m_right->maxId())),
+              m_key(key) {}
 
-                if (iv->key() < toKey) {
-                    reportSubtree(iv->left(), result);
-                    v = iv->right();
-                } else {
-                    v = iv->left();
-                }
-                lv = dynamic_cast<LeafPtr>(v);
-            }
-            if (fromKey <= lv->key() && lv->key() < toKey) {
-                result.push_back(lv->get());
-            }
-        }
+    NodePtr left() const { return m_left.get(); }
+
+    NodePtr right() const { return m_right.get(); }
+
+    Key key() const override { return m_key; }
+
+    size_t size() const override { return m_size; }
+
+    PointId minId() const override { return m_minId; }
+
+    PointId maxId() const override { return m_maxId; }
+
+    void print(std::ostream &os) const override {
+        m_left->print(os);
+        os << ',';
+        m_right->print(os);
     }
+};
 
-    friend std::ostream &operator<<(std::ostream &os, const RangeTree<T, 1, D> &rt) {
-        os << '[';
-        rt.m_root->print(os);
-        return os << ']';
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, dim_t D, typename E>
+class RangeTree<T, 1, D, E> : public RangeTreeBase<T, 1, D, E> {
+    using Base = RangeTreeBase<T, 1, D, E>;
+    using NodeUP = std::unique_ptr<Node<T, 1, E>>;
+    using NodePtr = const Node<T, 1, E> *;
+    using LeafPtr = const LeafNode<T, 1, D, E> *;
+    using InnerPtr = const InnerNode<T, 1, E> *;
+    using Key = typename E::Key;
+
+    friend Base;
+
+public:
+    using Base::Base;
+
+    // trees with L = 1 have no associated trees, the mode is ignored
+    static NodeUP buildTree(const RefIt<T, D> &beg, const RefIt<T, D> &end, size_t leafSize, AssocMode mode) {
+        if (static_cast<size_t>(end - beg) <= leafSize) {
+            return std::make_unique<LeafNode<T, 1, D, E>>(beg, end);
+        } else {
+            RefIt<T, D> m = beg + (end - beg) / 2;
+            return std::make_unique<InnerNode<T, 1, E>>(E::encode((**(m - 1))[D - 1]), buildTree(beg, m, leafSize, mode),
+                                                        buildTree(m, end, leafSize, mode));
+        }
     }
 
 private:
-    static NodePtr findSplitNode(NodePtr v, const T &from, const T &to) {
+    using Base::addSubtree;
+    using Base::reportVerified;
+
+    template<class Region, class Result>
+    static void reportCanonical(NodePtr v, const Region &region, Result &result) {
+        if (Region::separable && E::exact) {
+            // all points of v are inside the query box, they are copied when the result is collected
+            addSubtree(v, result);
+        } else {
+            // the points of v are only inside the key range of the last coordinate of the region
+            reportClipped(v, firstCoord(v), lastCoord(v), region, result);
+        }
+    }
+
+    // reports the points of v, whose last coordinates are in [first, last], inside the region: subtrees are pruned
+    // or reported completely by their overlap with the region, or verified if the points may lie outside the region
+    // in preceding coordinates
+    template<class Region, class Result>
+    static void reportClipped(NodePtr v, const T &first, const T &last, const Region &region,
+                              Result &result) {
         auto lv = dynamic_cast<LeafPtr>(v);
 
-        while (!lv && (to <= v->key() || v->key() < from)) {
-            auto iv = static_cast<InnerPtr>(v);
+        if (lv) {
+            lv->report(region, result);
+        } else {
+            const Box<Key, 1> keys(Point<Key, 1>(E::encode(first)), Point<Key, 1>(E::encode(last)));
+            const Overlap overlap = region.overlap(keys);
+
+            if (overlap == Overlap::Inside && region.precedingInside) {
+                addSubtree(v, result);
+            } else if (overlap == Overlap::Inside) {
+                reportVerified(v, region, result);
+            } else if (overlap != Overlap::Disjoint) {
+                auto iv = static_cast<InnerPtr>(v);
 
-            if (to <= v->key()) {
-                v = iv->left();
-            } else {
-                v = iv->right();
+                reportClipped(iv->left(), first, lastCoord(iv->left()), region, result);
+                reportClipped(iv->right(), firstCoord(iv->right()), last, region, result);
             }
-            lv = dynamic_cast<LeafPtr>(v);
         }
-        return v;
     }
 
-    static void reportSubtree(NodePtr v, std::vector<Point<T, D>> &result) {
+    // smallest and largest last coordinate of the points of v
+    static const T &firstCoord(NodePtr v) {
         auto lv = dynamic_cast<LeafPtr>(v);
 
-        if (lv) {
-            // v is a leaf
-            result.push_back(lv->get());
-        } else {
-            // v is an innerNode
-            auto iv = static_cast<InnerPtr>(v);
+        for (; !lv; lv = dynamic_cast<LeafPtr>(v)) v = static_cast<InnerPtr>(v)->left();
+        return lv->points()[0][D - 1];
+    }
 
-            reportSubtree(iv->left(), result);
-            reportSubtree(iv->right(), result);
-        }
+    static const T &lastCoord(NodePtr v) {
+        auto lv = dynamic_cast<LeafPtr>(v);
+
+        for (; !lv; lv = dynamic_cast<LeafPtr>(v)) v = static_cast<InnerPtr>(v)->right();
+        return lv->points()[lv->size() - 1][D - 1];
     }
 };
 
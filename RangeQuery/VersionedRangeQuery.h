@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "RangeQuery.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Versioned range query: a handle to the current version of an index, which
+// is replaced by rebuilds while queries are in flight.
+// Rebuilds are built one after another by a builder thread owned by the
+// index, and each new version is published with an atomic pointer swap.
+// Readers never take a lock: they announce the epoch they have entered in one
+// of ReaderSlots slots, load the current version and clear their slot when
+// they are done. Readers only wait if more than ReaderSlots snapshots are
+// held at the same time, then they yield until a slot is cleared. A replaced
+// version is retired with the epoch after its replacement and freed as soon
+// as no reader is in an older epoch (epoch-based reclamation): the builder
+// thread frees it when it publishes a version or when a reader leaving the
+// last snapshot wakes it, so readers never free versions themselves. Only
+// writers synchronise with each other through a mutex.
+//
+
+template<class P, class E = ExactKey<typename P::ElementType>>
+class VersionedRangeQuery {
+public:
+    static constexpr size_t ReaderSlots = 128;
+    static constexpr std::chrono::milliseconds ReclaimInterval{10};
+
+    // an immutable version of the index, completely built before it is published, so that no reader builds any part
+    class Version {
+        RangeQuery<P, E> m_query;
+        uint64_t m_number;
+
+    public:
+        Version(std::vector<P> &&points, size_t leafSize, uint64_t number)
+                : m_query(std::move(points), leafSize, AssocMode::Eager), m_number(number) {}
+
+        const std::vector<P> &points() const { return m_query.points(); }
+
+        const RangeQuery<P, E> &query() const { return m_query; }
+
+        uint64_t number() const { return m_number; }
+    };
+
+    // keeps a version alive while a reader uses it
+    class Snapshot {
+        VersionedRangeQuery *m_index;
+        std::atomic<uint64_t> *m_slot;
+        const Version *m_version;
+
+    public:
+        Snapshot(VersionedRangeQuery *index, std::atomic<uint64_t> *slot, const Version *version)
+                : m_index(index), m_slot(slot), m_version(version) {}
+
+        Snapshot(Snapshot &&other) noexcept : m_index(other.m_index), m_slot(other.m_slot), m_version(other.m_version) {
+            other.m_slot = nullptr;
+        }
+
+        Snapshot(const Snapshot &) = delete;
+
+        Snapshot &operator=(const Snapshot &) = delete;
+
+        // the builder frees the retired versions which this was the last reader of
+        ~Snapshot() {
+            if (m_slot) {
+                m_slot->store(0);
+                if (m_index->m_numOfRetired.load() != 0) m_index->m_builderWakeup.notify_one();
+            }
+        }
+
+        const Version &operator*() const { return *m_version; }
+
+        const Version *operator->() const { return m_version; }
+    };
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};     // epoch of the reader using this slot, 0 if the slot is free
+    };
+
+    struct Retired {
+        std::unique_ptr<Version> version;
+        uint64_t epoch;                     // readers in this or a later epoch can't see the version
+    };
+
+    struct Rebuild {
+        std::vector<P> points;
+        uint64_t number;
+        std::promise<void> published;
+    };
+
+    std::atomic<Version *> m_current;
+    std::atomic<uint64_t> m_epoch{1};
+    std::array<Slot, ReaderSlots> m_slots;
+    size_t m_leafSize;
+
+    std::mutex m_writer;
+    std::vector<Retired> m_retired;
+    std::atomic<size_t> m_numOfRetired{0};  // size of m_retired, read by readers without the mutex
+    uint64_t m_numOfVersions = 1;
+
+    // requested rebuilds, guarded by m_writer
+    std::deque<Rebuild> m_rebuilds;
+    std::condition_variable m_builderWakeup;
+    bool m_stopping = false;
+    std::thread m_builder;
+
+public:
+    explicit VersionedRangeQuery(std::vector<P> points, size_t leafSize = DefaultLeafSize)
+            : m_current(new Version(std::move(points), leafSize, 1)), m_leafSize(leafSize) {}
+
+    VersionedRangeQuery(const VersionedRangeQuery &) = delete;
+
+    VersionedRangeQuery &operator=(const VersionedRangeQuery &) = delete;
+
+    // all readers must have finished; waits for the rebuild in progress, rebuilds which haven't started are dropped
+    ~VersionedRangeQuery() {
+        {
+            std::lock_guard<std::mutex> lock(m_writer);
+            m_stopping = true;
+        }
+        m_builderWakeup.notify_one();
+        if (m_builder.joinable()) m_builder.join();
+        delete m_current.load();
+    }
+
+    /// <summary>
+    /// Return a snapshot of the current version. The version isn't freed before the snapshot is destroyed.
+    /// If all ReaderSlots slots are taken, the reader yields until another snapshot is destroyed.
+    /// </summary>
+    Snapshot snapshot() {
+        const size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+        for (size_t i = 0;; i++) {
+            Slot &slot = m_slots[(start + i) % ReaderSlots];
+            uint64_t expected = 0;
+
+            // the epoch must be announced before the version is loaded
+            if (slot.epoch.load(std::memory_order_relaxed) == 0 &&
+                slot.epoch.compare_exchange_strong(expected, m_epoch.load())) {
+                return Snapshot(this, &slot.epoch, m_current.load());
+            }
+            if (i % ReaderSlots == ReaderSlots - 1) std::this_thread::yield();
+        }
+    }
+
+    std::vector<P> efficient(const P &from, const P &to, unsigned threads = 0) {
+        return snapshot()->query().efficient(from, to, threads);
+    }
+
+    /// <summary>
+    /// Build a new version of the points in the background and publish it when it is built. The returned future is
+    /// ready when the version or a later one has been published, it may be discarded without waiting. A rebuild which
+    /// is superseded by a later one before it has started is skipped.
+    /// </summary>
+    std::future<void> rebuild(std::vector<P> points) {
+        std::future<void> published;
+        {
+            std::lock_guard<std::mutex> lock(m_writer);
+
+            m_rebuilds.push_back({std::move(points), ++m_numOfVersions, std::promise<void>()});
+            published = m_rebuilds.back().published.get_future();
+            if (!m_builder.joinable()) m_builder = std::thread([this]() { build(); });
+        }
+        m_builderWakeup.notify_one();
+        return published;
+    }
+
+    /// <summary>
+    /// Free all retired versions, which no reader can use anymore, and return the number of remaining retired versions.
+    /// The builder thread does this on its own, at the latest ReclaimInterval after the last reader has left.
+    /// </summary>
+    size_t reclaim() {
+        std::lock_guard<std::mutex> lock(m_writer);
+        return reclaimRetired();
+    }
+
+    /// <summary>
+    /// Return the number of retired versions which haven't been freed yet.
+    /// </summary>
+    size_t numOfRetired() const { return m_numOfRetired.load(); }
+
+private:
+    // the builder thread: builds and publishes the requested versions in order and frees the retired versions until
+    // the index is destroyed
+    void build() {
+        std::unique_lock<std::mutex> lock(m_writer);
+
+        for (;;) {
+            reclaimRetired();
+            if (m_stopping) return;
+            if (m_rebuilds.empty()) {
+                // a reader may leave before the builder waits, hence retired versions are checked every ReclaimInterval
+                if (m_retired.empty()) {
+                    m_builderWakeup.wait(lock);
+                } else {
+                    m_builderWakeup.wait_for(lock, ReclaimInterval);
+                }
+                continue;
+            }
+
+            // only the latest requested version needs to be built
+            std::vector<std::promise<void>> published;
+            while (m_rebuilds.size() > 1) {
+                published.push_back(std::move(m_rebuilds.front().published));
+                m_rebuilds.pop_front();
+            }
+            Rebuild rebuild = std::move(m_rebuilds.front());
+            m_rebuilds.pop_front();
+            published.push_back(std::move(rebuild.published));
+
+            lock.unlock();
+            try {
+                publish(std::make_unique<Version>(std::move(rebuild.points), m_leafSize, rebuild.number));
+                for (auto &promise: published) promise.set_value();
+            } catch (...) {
+                for (auto &promise: published) promise.set_exception(std::current_exception());
+            }
+            lock.lock();
+        }
+    }
+
+    void publish(std::unique_ptr<Version> &&version) {
+        std::lock_guard<std::mutex> lock(m_writer);
+        Version *old = m_current.exchange(version.release());
+
+        // readers entering from now on see the new version
+        m_retired.push_back({std::unique_ptr<Version>(old), ++m_epoch});
+        reclaimRetired();
+    }
+
+    size_t reclaimRetired() {
+        uint64_t oldest = m_epoch.load();
+
+        for (const Slot &slot: m_slots) {
+            const uint64_t epoch = slot.epoch.load();
+            if (epoch != 0) oldest = std::min(oldest, epoch);
+        }
+        m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                       [oldest](const Retired &r) { return r.epoch <= oldest; }),
+                        m_retired.end());
+        m_numOfRetired.store(m_retired.size());
+        return m_retired.size();
+    }
+};